@@ -63,3 +63,49 @@ fpp_off_t swap_offset(fpp_off_t off)
         dst[i] = src[7 - i];
     return ret;
 }
+
+const char *rv_name(int rv)
+{
+    switch (rv) {
+    case 0:
+        return "completed";
+    case RV_TERMINATED:
+        return "terminated";
+    case RV_NACK:
+        return "nack";
+    case RV_REJECT:
+        return "reject";
+    case RV_UNEXPECTED:
+        return "unexpected";
+    case RV_IOERROR:
+        return "ioerror";
+    case RV_NETIOERROR:
+        return "netioerror";
+    case RV_CONNCLOSED:
+        return "connclosed";
+    case RV_RESUME_ACK:
+        return "resume_ack";
+    case RV_RESUME_NACK:
+        return "resume_nack";
+    case RV_LOCAL_BIGGER:
+        return "local_bigger";
+    case RV_NOENT:
+        return "noent";
+    case RV_NOT_REGULAR_FILE:
+        return "not_regular_file";
+    case RV_TOOBIG:
+        return "toobig";
+    case RV_DIGEST_MATCH:
+        return "digest_match";
+    case RV_SIZE_MATCH:
+        return "size_match";
+    case RV_COMPLETED_DIGEST_MISMATCH:
+        return "digest_mismatch";
+    case RV_OFFSET:
+        return "offset";
+    case RV_WOULDBLOCK:
+        return "wouldblock";
+    default:
+        return "other";
+    }
+}
@@ -1,19 +1,28 @@
 DEPFLAGS = -MMD -MP
 CFLAGS += $(DEPFLAGS) -Wall -W -I$(src_topdir)/$(HOST) -I$(src_topdir)
 progs =
+libs =
 exeext =
 
 push-objs  = push.o
 push-objs += common.o
 push-objs += libpush.o
 push-objs += platform.o
+push-objs += progress.o
 push-objs += sha1.o
+push-objs += source.o
+push-objs += stats.o
+push-objs += transport.o
 
 catch-objs  = catch.o
 catch-objs += common.o
 catch-objs += libcatch.o
 catch-objs += platform.o
+catch-objs += progress.o
 catch-objs += sha1.o
+catch-objs += sink.o
+catch-objs += stats.o
+catch-objs += transport.o
 
 -include $(src_topdir)/$(HOST)/include.mk
 
@@ -24,10 +33,10 @@ deps = $(patsubst %.o, %.d, $(filter %.o, $(objs)))
 
 vpath %.c $(src_topdir)/$(HOST) $(src_topdir)
 
-all: $(fqprogs)
+all: $(fqprogs) $(libs)
 
 clean:
-	rm -f $(deps) $(objs) $(fqprogs)
+	rm -f $(deps) $(objs) $(fqprogs) $(libs)
 
 push$(exeext): $(push-objs)
 	$(CC) $(CFLAGS) $^ $(push-libs) -o $@
@@ -75,12 +75,18 @@ static int handle_connection(tcp_Socket *sk)
     int rv = 0;
     int close_connection = 0;
     char filename[4096];
+    struct transport tr;
+    struct sink sink;
     struct catch_context ctx;
 
+    sock_transport_init(&tr, sk);
+    stdio_sink_init(&sink);
+
     memset(&ctx, '\0', sizeof ctx);
     ctx.terminate = &terminate;
     ctx.on_stage_change = on_stage_change;
-    ctx.sk = sk;
+    ctx.tr = &tr;
+    ctx.sink = &sink;
     ctx.filename = filename;
     ctx.filenamesz = sizeof filename;
     ctx.calc_digest = use_digests;
@@ -185,7 +191,7 @@ int catch(int argc, const char *argv[])
 
             if (sock_recv_from(&udp_sk, &peer_addr, &peer_port,
                                &disc_req, sizeof disc_req, 0)) {
-                if (disc_req == DISCOVERY_VER) {
+                if (disc_req == DISCOVERY_VER_MIN) {
                     peer_addr = ntohl(peer_addr);
                     peer_port = ntohs(peer_port);
                     if (udp_open(&udp_out_sk, CATCH_PORT,
@@ -1,5 +1,6 @@
 #include "common.h"
 #include "platform.h"
+#include "transport.h"
 
 #include <errno.h>
 #include <stdio.h>
@@ -7,6 +8,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
 #define PATHSEP '\\'
 
@@ -48,18 +50,57 @@ int get_filelen(const char *filename, off_t *filelen)
     return rv;
 }
 
+/* Returns 0 and number of bytes sent, RV_WOULDBLOCK if nothing could be
+ * sent right now, or error number. WatTCP sockets never block. */
+int send_some(Sock sk, const void *buf, size_t len, size_t *nsent)
+{
+    int nwritten = sock_fastwrite(sk, (byte *)buf, len);
+    *nsent = (nwritten > 0) ? nwritten : 0;
+    if (!tcp_tick(sk))
+        return RV_CONNCLOSED;
+    return (*nsent) ? 0 : RV_WOULDBLOCK;
+}
+
+/* WatTCP cannot gather, so only (a part of) the first segment is sent,
+ * which callers are prepared for. */
+int send_somev(Sock sk, const struct tr_iovec *iov, int iovcnt, int more,
+               size_t *nsent)
+{
+    UNUSED(iovcnt);
+    UNUSED(more);
+    return send_some(sk, iov[0].base, iov[0].len, nsent);
+}
+
+/* Returns 0 and number of bytes received, RV_WOULDBLOCK if nothing has
+ * been received yet, or error number. WatTCP sockets never block. */
+int recv_some(Sock sk, void *buf, size_t len, size_t *nreceived)
+{
+    int nread = sock_fastread(sk, buf, len);
+    *nreceived = (nread > 0) ? nread : 0;
+    if (!tcp_tick(sk))
+        return RV_CONNCLOSED;
+    return (*nreceived) ? 0 : RV_WOULDBLOCK;
+}
+
+/* WatTCP has nothing to wait on but its own polling, so the socket is
+ * just serviced once. Returns 0 or RV_CONNCLOSED. */
+int wait_ready(Sock sk, int writing)
+{
+    UNUSED(writing);
+    return tcp_tick(sk) ? 0 : RV_CONNCLOSED;
+}
+
 /* Returns 0 if entire buffer was sent, or error number otherwise. */
 int send_entire(Sock sk, const void *buf, size_t len)
 {
     const char *src = buf;
     while (len && !terminate) {
-        int nwritten = sock_fastwrite(sk, buf, len);
-        if (nwritten > 0) {
-            src += nwritten;
-            len -= nwritten;
-        }
-        if (!tcp_tick(sk))
-            return RV_CONNCLOSED;
+        size_t nsent;
+        int rv = send_some(sk, src, len, &nsent);
+        if (rv && rv != RV_WOULDBLOCK)
+            return rv;
+        src += nsent;
+        len -= nsent;
     }
     return (len) ? RV_TERMINATED : 0;
 }
@@ -69,13 +110,12 @@ int recv_entire(Sock sk, void *buf, size_t len)
 {
     char *dst = buf;
     while (len && !terminate) {
-        int nread = sock_fastread(sk, dst, len);
-        if (nread > 0) {
-            dst += nread;
-            len -= nread;
-        }
-        if (!tcp_tick(sk))
-            return RV_CONNCLOSED;
+        size_t nreceived;
+        int rv = recv_some(sk, dst, len, &nreceived);
+        if (rv && rv != RV_WOULDBLOCK)
+            return rv;
+        dst += nreceived;
+        len -= nreceived;
     }
     return (len) ? RV_TERMINATED : 0;
 }
@@ -87,3 +127,11 @@ fpp_off_t to_fpp_off(off_t off)
     fpp_off.word[1] = 0;
     return fpp_off;
 }
+
+/* Nothing else runs meanwhile, so CPU time is the same. */
+void get_clocks(double *wall, double *cpu)
+{
+    *wall = (double)clock() / CLK_TCK;
+    if (cpu)
+        *cpu = *wall;
+}
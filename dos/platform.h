@@ -27,6 +27,13 @@ int get_filelen(const char *filename, off_t *filelen);
 void sanitize_filename(char *filename);
 int send_entire(Sock sk, const void *buf, size_t len);
 int recv_entire(Sock sk, void *buf, size_t len);
+int send_some(Sock sk, const void *buf, size_t len, size_t *nsent);
+int recv_some(Sock sk, void *buf, size_t len, size_t *nreceived);
+struct tr_iovec;
+int send_somev(Sock sk, const struct tr_iovec *iov, int iovcnt, int more,
+               size_t *nsent);
+int wait_ready(Sock sk, int writing);
+void get_clocks(double *wall, double *cpu);
 
 #define to_off(fpp_off) (((fpp_off).word[1] != 0) ? -1 : (fpp_off).word[0])
 fpp_off_t to_fpp_off(off_t off);
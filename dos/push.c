@@ -37,7 +37,7 @@ static in_addr_t resolve_peername(const char *peername)
     for (i = 0; i < 5 && peer_addr == INADDR_NONE && !terminate; i++)
     {
         long timeout = set_timeout(1);
-        uint8_t req = DISCOVERY_VER;
+        uint8_t req = DISCOVERY_VER_MIN;
         if (send_entire(&udp_sk, &req, sizeof req) != 0)
             die("Could not send discovery request");
 
@@ -115,25 +115,32 @@ static void die_push(const struct push_context *ctx, const char *msg)
 static int push_file(tcp_Socket *sk, const char *pathname)
 {
     int rv = 0;
+    struct transport tr;
+    struct source src;
     struct push_context ctx;
+    FILE *fp;
+    sock_transport_init(&tr, sk);
+    memset(&ctx, '\0', sizeof ctx);
     ctx.terminate = &terminate;
-    ctx.sk = sk;
+    ctx.tr = &tr;
     ctx.filename = basename(pathname);
     ctx.filelen = get_filelen_or_die(pathname);
     ctx.fileoff = 0;
     ctx.calc_digest = use_digests;
     ctx.forced = use_force;
     ctx.on_stage_change = on_stage_change;
-    ctx.fp = fopen(pathname, "rb"); /* b in mode is important for DOS */
-    if (!ctx.fp)
+    fp = fopen(pathname, "rb"); /* b in mode is important for DOS */
+    if (!fp)
         die_errno("Cannot open file %s", pathname);
+    stdio_source_init(&src, fp, ctx.filelen);
+    ctx.src = &src;
 
     info("Sending file %s (%lu bytes)", pathname,
          (unsigned long)ctx.filelen);
 
     rv = libpush_push_file(&ctx);
 
-    fclose(ctx.fp);
+    fclose(fp);
 
     switch (rv) {
     case 0:
@@ -12,6 +12,9 @@
 #define MSG_REJECT_OFFSET   4
 #define MSG_ACK             5
 #define MSG_NACK            6
+#define MSG_ACCEPT_FD       7 /* accepted, content copied from passed file */
+#define MSG_SPARSE_PUSH     8 /* MSG_PUSH of content sent as extents */
+#define MSG_FORCED_SPARSE_PUSH 9 /* MSG_FORCED_PUSH of such content */
 
 typedef uint8_t fpp_msg_t;
 typedef uint64_t fpp_off_t;
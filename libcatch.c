@@ -8,263 +8,546 @@
 #include "sha1.h"
 #include "sha1util.h"
 
-#define BLOCKSIZE 512
+enum catch_state {
+    STATE_REQUEST,        /* receiving type of the request */
+    STATE_NAMELEN,        /* receiving length of the file name */
+    STATE_NAME,           /* receiving the file name */
+    STATE_OFFSET,         /* receiving offset of a non-forced push */
+    STATE_FILELEN,        /* receiving length of the file */
+    STATE_ACCEPT,         /* sending MSG_ACCEPT */
+    STATE_RESUME_SHA1,    /* calculating digest of the initial part */
+    STATE_RESUME_DIGEST,  /* receiving digest of the initial part */
+    STATE_RESUME_ACK,     /* sending MSG_ACK to that digest */
+    STATE_DATA,           /* receiving content of the file */
+    STATE_EXTENT,         /* receiving header of the next extent of data */
+    STATE_HOLE,           /* filling a hole left out by the peer */
+    STATE_COPY,           /* copying content from file passed by peer */
+    STATE_DIGEST,         /* receiving digest of the entire file */
+    STATE_REPLY,          /* sending the last message, then done */
+    STATE_DONE
+};
+
+static int is_sending(int state)
+{
+    return state == STATE_ACCEPT || state == STATE_RESUME_ACK ||
+           state == STATE_REPLY;
+}
 
-static int receive_chunk(struct catch_context *ctx, SHA1_CTX *sha1_ctx)
+/* Switch to the state, which starts with transfer of len bytes of buf. */
+static void enter(struct catch_context *ctx, int state, void *buf, size_t len)
 {
-    int rv = 0;
-    off_t nleft = ctx->filelen - ctx->filepos;
+    ctx->state = state;
+    ctx->io = buf;
+    ctx->iolen = len;
+    ctx->iopos = 0;
+}
 
-    while (nleft && !*ctx->terminate) {
-        unsigned char buf[BLOCKSIZE];
-        size_t chunk = (nleft > BLOCKSIZE) ? BLOCKSIZE : nleft;
-        rv = recv_entire(ctx->sk, (char *)buf, chunk);
-        if (!rv) {
-            if (fwrite(buf, 1, chunk, ctx->fp) != chunk)
-                return RV_IOERROR;
-            nleft -= chunk;
-            ctx->filepos += chunk;
-            if (ctx->calc_digest)
-                SHA1Update(sha1_ctx, buf, chunk);
-            if (ctx->on_progress)
-                ctx->on_progress(ctx, CATCH_RECEIVE);
-        } else {
-            return rv;
-        }
+static void finish(struct catch_context *ctx, int rv)
+{
+    if (ctx->sink_open) {
+        ctx->sink_open = 0;
+        if (ctx->sink->finalize(ctx->sink, rv) != 0 && !rv)
+            rv = RV_IOERROR;
     }
-
-    if (nleft > 0) {
+    /* The peer may close the connection between requests, but not
+     * in the middle of one. */
+    if (rv == RV_CONNCLOSED &&
+        (ctx->state != STATE_REQUEST || ctx->iopos > 0))
         rv = RV_TERMINATED;
-    } else {
-        struct sha1 digest, peer_digest;
-
-        SHA1Final((unsigned char *)&digest, sha1_ctx);
-        rv = recv_entire(ctx->sk, &peer_digest, sizeof peer_digest);
-        if (!rv) {
-            if (ctx->calc_digest && memcmp(&digest, &peer_digest, sizeof digest)) {
-                rv = send_short_msg(ctx->sk, MSG_NACK);
-                if (!rv)
-                    rv = RV_COMPLETED_DIGEST_MISMATCH;
-            } else {
-                rv = send_short_msg(ctx->sk, MSG_ACK);
-            }
-        }
-    }
 
-    return rv;
+    ctx->rv = rv;
+    enter(ctx, STATE_DONE, NULL, 0);
 }
 
-static int accept_file(struct catch_context *ctx)
+/* Send the message and finish with rv once it is sent. */
+static void reply(struct catch_context *ctx, fpp_msg_t msg, int rv)
 {
-    int rv;
-    struct sha1 peer_digest;
-    SHA1_CTX sha1_ctx;
-    SHA1Init(&sha1_ctx);
-
-    rv = send_short_msg(ctx->sk, MSG_ACCEPT);
-    if (rv)
-        return rv;
-
-    ctx->filepos = 0;
-
-    if (ctx->fileoff) {
-        if (ctx->calc_digest) {
-            off_t nleft = ctx->fileoff;
-
-            if (ctx->on_stage_change)
-                ctx->on_stage_change(ctx, CATCH_SHA1_CALC);
-
-            while (nleft > 0) {
-                unsigned char buf[BLOCKSIZE];
-                size_t chunk = (nleft > BLOCKSIZE) ? BLOCKSIZE : nleft;
-
-                if (fread(buf, 1, chunk, ctx->fp) != chunk)
-                    return RV_IOERROR;
-
-                SHA1Update(&sha1_ctx, buf, chunk);
-                nleft -= chunk;
-                ctx->filepos += chunk;
-
-                if (ctx->on_progress)
-                    ctx->on_progress(ctx, CATCH_SHA1_CALC);
-
-                if (*ctx->terminate)
-                    return RV_TERMINATED;
-            }
-        } else {
-            ctx->filepos = ctx->fileoff;
-        }
+    ctx->rv = rv;
+    ctx->buf[0] = msg;
+    enter(ctx, STATE_REPLY, ctx->buf, sizeof msg);
+}
 
-        rv = recv_entire(ctx->sk, &peer_digest, sizeof peer_digest);
-        if (rv)
-            return rv;
+static void reject_file_offset(struct catch_context *ctx, off_t offset)
+{
+    fpp_msg_t msg = MSG_REJECT_OFFSET;
+    fpp_off_t off = hton_offset(to_fpp_off(offset));
+    memcpy(ctx->buf, &msg, sizeof msg);
+    memcpy(ctx->buf + sizeof msg, &off, sizeof off);
 
-        if (ctx->calc_digest) {
-            SHA1_CTX sha1_tmp_ctx = sha1_ctx;
-            struct sha1 digest;
-            SHA1Final((unsigned char *)&digest, &sha1_tmp_ctx);
+    ctx->rv = RV_OFFSET;
+    enter(ctx, STATE_REPLY, ctx->buf, sizeof msg + sizeof off);
+}
 
-            if (memcmp(&digest, &peer_digest, sizeof digest)) {
-                rv = send_short_msg(ctx->sk, MSG_NACK);
-                return (rv) ? rv : RV_NACK;
-            }
-        }
+static void hash(struct catch_context *ctx, const void *buf, size_t len)
+{
+    struct stats_mark mark;
 
-        rv = send_short_msg(ctx->sk, MSG_ACK);
-        if (rv)
-            return rv;
-    }
+    stats_start(ctx->stats, &mark);
+    SHA1Update(&ctx->sha1_ctx, buf, len);
+    stats_add(ctx->stats, STATS_HASH, &mark, len);
+}
 
-    if (!ctx->filelen || ctx->filepos < ctx->filelen) {
-        if (ctx->on_stage_change)
-            ctx->on_stage_change(ctx, CATCH_RECEIVE);
+static int read_at(struct catch_context *ctx, off_t off, void *buf,
+                   size_t len)
+{
+    struct stats_mark mark;
+    int rv;
 
-        /* C standard requires a call to a file position function when
-         * switching from reading to writing. Unless this is done, the
-         * following fwrite call fails at least on Windows. */
-        fseek(ctx->fp, 0L, SEEK_CUR);
+    stats_start(ctx->stats, &mark);
+    rv = ctx->sink->read_at(ctx->sink, off, buf, len);
+    stats_add(ctx->stats, STATS_READ, &mark, len);
+    return rv;
+}
 
-        rv = receive_chunk(ctx, &sha1_ctx);
-    } else {
-        rv = (ctx->calc_digest) ? RV_DIGEST_MATCH : RV_SIZE_MATCH;
-    }
+static int write_at(struct catch_context *ctx, off_t off, const void *buf,
+                    size_t len)
+{
+    struct stats_mark mark;
+    int rv;
 
+    stats_start(ctx->stats, &mark);
+    rv = ctx->sink->write_at(ctx->sink, off, buf, len);
+    stats_add(ctx->stats, STATS_WRITE, &mark, len);
     return rv;
 }
 
-static int reject_file(struct catch_context *ctx)
+/* Get the buffer for content and its size. */
+static unsigned char *chunk_buf(struct catch_context *ctx, size_t *size)
 {
-    return send_short_msg(ctx->sk, MSG_REJECT);
+    if (ctx->chunkbuf && ctx->chunksize) {
+        *size = ctx->chunksize;
+        return ctx->chunkbuf;
+    }
+    *size = CATCH_BUFSIZE;
+    return ctx->buf;
 }
 
-static int reject_file_offset(struct catch_context *ctx, off_t offset)
+/* Report progress of the stage if it is due. */
+static void report_progress(struct catch_context *ctx, int stage)
 {
-    fpp_msg_t msg = MSG_REJECT_OFFSET;
-    fpp_off_t off = hton_offset(to_fpp_off(offset));
-    char buf[sizeof msg + sizeof off];
-    memcpy(buf, &msg, sizeof msg);
-    memcpy(buf + sizeof msg, &off, sizeof off);
-
-    return send_entire(ctx->sk, buf, sizeof buf);
+    if (ctx->on_progress && progress_update(&ctx->progress, ctx->filepos))
+        ctx->on_progress(ctx, stage);
 }
 
-static int handle_push_request(struct catch_context *ctx)
+static void receive_data(struct catch_context *ctx)
 {
-    int rv;
-    uint16_t namelen;
-    fpp_off_t fpp_off;
-    off_t filelen;
-    int new_file = 1;
-
-    rv = recv_entire(ctx->sk, &namelen, sizeof namelen);
-    if (rv)
-        return rv;
-
-    namelen = ntohs(namelen);
-    if (namelen >= ctx->filenamesz)
-        return RV_UNEXPECTED;
-
-    rv = recv_entire(ctx->sk, ctx->filename, namelen);
-    if (rv)
-        return rv;
-
-    ctx->filename[namelen] = '\0';
-    sanitize_filename(ctx->filename);
-
-    if (!ctx->forced) {
-        rv = recv_entire(ctx->sk, &fpp_off, sizeof fpp_off);
-        if (rv)
-            return rv;
-
-        ctx->fileoff = to_off(ntoh_offset(fpp_off));
-
-        if (ctx->fileoff == -1) {
-            rv = reject_file(ctx);
-            return (rv) ? rv : RV_TOOBIG;
+    if (!ctx->filelen || ctx->filepos < ctx->filelen) {
+        if (ctx->on_stage_change)
+            ctx->on_stage_change(ctx, CATCH_RECEIVE);
+        progress_start(&ctx->progress, ctx->filepos, ctx->filelen);
+        if (ctx->extents) {
+            enter(ctx, STATE_EXTENT, ctx->buf, 2 * sizeof(fpp_off_t));
+        } else {
+            ctx->extent_end = ctx->filelen;
+            enter(ctx, (ctx->srcfd >= 0) ? STATE_COPY : STATE_DATA,
+                  ctx->buf, 0);
         }
     } else {
-        ctx->fileoff = 0;
+        finish(ctx, (ctx->calc_digest) ? RV_DIGEST_MATCH : RV_SIZE_MATCH);
     }
+}
 
-    rv = recv_entire(ctx->sk, &fpp_off, sizeof fpp_off);
-    if (rv)
-        return rv;
+static void handle_filelen(struct catch_context *ctx)
+{
+    fpp_off_t fpp_off;
+    off_t filelen;
+    int new_file = 1;
+    int rv;
 
+    memcpy(&fpp_off, ctx->buf, sizeof fpp_off);
     ctx->filelen = to_off(ntoh_offset(fpp_off));
 
     if (ctx->filelen == -1) {
-        rv = reject_file(ctx);
-        return (rv) ? rv : RV_TOOBIG;
+        reply(ctx, MSG_REJECT, RV_TOOBIG);
+        return;
     }
 
     if (ctx->fileoff > ctx->filelen) {
-        rv = reject_file(ctx);
-        return (rv) ? rv : RV_UNEXPECTED;
+        reply(ctx, MSG_REJECT, RV_UNEXPECTED);
+        return;
     }
 
     if (ctx->forced && !ctx->allow_forced) {
-        rv = reject_file(ctx);
-        return (rv) ? rv : RV_REJECT;
+        reply(ctx, MSG_REJECT, RV_REJECT);
+        return;
     }
 
-    rv = get_filelen(ctx->filename, &filelen);
+    rv = ctx->sink->stat(ctx->sink, ctx->filename, &filelen);
     if (rv == RV_NOENT) {
         if (ctx->fileoff) {
-            rv = reject_file_offset(ctx, 0);
-            return (rv) ? rv : RV_OFFSET;
+            reject_file_offset(ctx, 0);
+            return;
         }
     } else if (rv == 0) {
         if (!ctx->forced) {
             if (filelen == 0 && ctx->fileoff == 0 && ctx->filelen == 0) {
-                rv = send_short_msg(ctx->sk, MSG_ACK);
-                return (rv) ? rv : RV_DIGEST_MATCH;
+                reply(ctx, MSG_ACK, RV_DIGEST_MATCH);
+                return;
             } else if (filelen > ctx->filelen) {
-                rv = reject_file(ctx);
-                return (rv) ? rv : RV_LOCAL_BIGGER;
+                reply(ctx, MSG_REJECT, RV_LOCAL_BIGGER);
+                return;
             } else if (filelen != ctx->fileoff) {
-                rv = reject_file_offset(ctx, filelen);
-                return (rv) ? rv : RV_OFFSET;
+                reject_file_offset(ctx, filelen);
+                return;
             }
             new_file = 0;
         }
     } else {
-        int rv2 = reject_file(ctx);
-        return (rv2) ? rv2 : rv;
+        reply(ctx, MSG_REJECT, rv);
+        return;
     }
 
     if (ctx->on_stage_change)
         ctx->on_stage_change(ctx, CATCH_NEXT_FILE);
 
-    /* b in mode is important for Windows. */
-    ctx->fp = fopen(ctx->filename, new_file ? "wb" : "rb+");
-    if (ctx->fp) {
-        rv = accept_file(ctx);
-        fclose(ctx->fp);
+    rv = ctx->sink->open(ctx->sink, ctx->filename, new_file, ctx->filelen);
+    if (rv) {
+        reply(ctx, MSG_REJECT, rv);
+        return;
+    }
+
+    ctx->sink_open = 1;
+    if (!ctx->sink->copy_from || ctx->extents)
+        ctx->srcfd = -1;
+    ctx->buf[0] = (ctx->srcfd >= 0) ? MSG_ACCEPT_FD : MSG_ACCEPT;
+    enter(ctx, STATE_ACCEPT, ctx->buf, sizeof(fpp_msg_t));
+}
+
+static void handle_accept(struct catch_context *ctx)
+{
+    SHA1Init(&ctx->sha1_ctx);
+    ctx->filepos = 0;
+
+    if (!ctx->fileoff) {
+        receive_data(ctx);
+    } else if (ctx->calc_digest) {
+        if (ctx->on_stage_change)
+            ctx->on_stage_change(ctx, CATCH_SHA1_CALC);
+        progress_start(&ctx->progress, 0, ctx->fileoff);
+        enter(ctx, STATE_RESUME_SHA1, ctx->buf, 0);
     } else {
-        rv = reject_file(ctx);
-        if (!rv)
-            rv = RV_IOERROR;
+        ctx->filepos = ctx->fileoff;
+        enter(ctx, STATE_RESUME_DIGEST, ctx->buf, sizeof(struct sha1));
     }
+}
 
-    return rv;
+static void resume_sha1(struct catch_context *ctx)
+{
+    off_t nleft = ctx->fileoff - ctx->filepos;
+
+    if (nleft > 0) {
+        size_t bufsize;
+        unsigned char *buf = chunk_buf(ctx, &bufsize);
+        size_t chunk = (nleft > (off_t)bufsize) ? bufsize : (size_t)nleft;
+
+        if (read_at(ctx, ctx->filepos, buf, chunk)) {
+            finish(ctx, RV_IOERROR);
+            return;
+        }
+
+        hash(ctx, buf, chunk);
+        ctx->filepos += chunk;
+        report_progress(ctx, CATCH_SHA1_CALC);
+    } else {
+        enter(ctx, STATE_RESUME_DIGEST, ctx->buf, sizeof(struct sha1));
+    }
 }
 
-int libcatch_handle_request(struct catch_context *ctx)
+static void handle_resume_digest(struct catch_context *ctx)
+{
+    if (ctx->calc_digest) {
+        SHA1_CTX sha1_tmp_ctx = ctx->sha1_ctx;
+        struct sha1 digest;
+        SHA1Final((unsigned char *)&digest, &sha1_tmp_ctx);
+
+        if (memcmp(&digest, ctx->buf, sizeof digest)) {
+            reply(ctx, MSG_NACK, RV_NACK);
+            return;
+        }
+    }
+
+    ctx->buf[0] = MSG_ACK;
+    enter(ctx, STATE_RESUME_ACK, ctx->buf, sizeof(fpp_msg_t));
+}
+
+static void receive_chunk(struct catch_context *ctx)
 {
-    fpp_msg_t req;
-    int rv = recv_entire(ctx->sk, &req, sizeof req);
-    if (rv)
-        return rv;
-
-    if (req == MSG_PUSH || req == MSG_FORCED_PUSH) {
-        ctx->forced = (req == MSG_FORCED_PUSH);
-        rv = handle_push_request(ctx);
+    size_t bufsize;
+    unsigned char *buf = chunk_buf(ctx, &bufsize);
+
+    /* The previous chunk (if any) has been received into the buffer. */
+    if (ctx->iolen) {
+        if (write_at(ctx, ctx->filepos, ctx->io, ctx->iolen)) {
+            finish(ctx, RV_IOERROR);
+            return;
+        }
+        ctx->filepos += ctx->iolen;
+        if (ctx->calc_digest)
+            hash(ctx, ctx->io, ctx->iolen);
+        report_progress(ctx, CATCH_RECEIVE);
+    }
+
+    if (ctx->filepos < ctx->extent_end) {
+        off_t nleft = ctx->extent_end - ctx->filepos;
+        size_t chunk = (nleft > (off_t)bufsize) ? bufsize : (size_t)nleft;
+        enter(ctx, STATE_DATA, buf, chunk);
+    } else if (ctx->extents) {
+        enter(ctx, STATE_EXTENT, ctx->buf, 2 * sizeof(fpp_off_t));
     } else {
-        rv = RV_UNEXPECTED;
+        enter(ctx, STATE_DIGEST, ctx->buf, sizeof(struct sha1));
     }
+}
 
-    if (rv == RV_CONNCLOSED)
-        rv = RV_TERMINATED;
+static void handle_extent(struct catch_context *ctx)
+{
+    fpp_off_t fpp_off;
+    off_t start, len;
+
+    memcpy(&fpp_off, ctx->buf, sizeof fpp_off);
+    start = to_off(ntoh_offset(fpp_off));
+    memcpy(&fpp_off, ctx->buf + sizeof fpp_off, sizeof fpp_off);
+    len = to_off(ntoh_offset(fpp_off));
+
+    /* Extents come in order, the empty one at the end of file is the last. */
+    if (start == -1 || len == -1 || start < ctx->filepos ||
+        start > ctx->filelen || len > ctx->filelen - start ||
+        (len == 0 && start != ctx->filelen)) {
+        finish(ctx, RV_UNEXPECTED);
+        return;
+    }
 
-    return rv;
+    if (start > ctx->filepos && ctx->sink->zero) {
+        struct stats_mark mark;
+        int rv;
+
+        stats_start(ctx->stats, &mark);
+        rv = ctx->sink->zero(ctx->sink, ctx->filepos, start - ctx->filepos);
+        stats_add(ctx->stats, STATS_WRITE, &mark, 0);
+        if (rv) {
+            finish(ctx, RV_IOERROR);
+            return;
+        }
+    }
+
+    ctx->hole_end = start;
+    ctx->extent_end = start + len;
+    enter(ctx, STATE_HOLE, ctx->buf, 0);
+}
+
+static void fill_hole(struct catch_context *ctx)
+{
+    off_t nleft = ctx->hole_end - ctx->filepos;
+
+    /* Zeros are hashed, and written unless the sink has made them. */
+    if (nleft > 0 && (ctx->calc_digest || !ctx->sink->zero)) {
+        size_t bufsize;
+        unsigned char *buf = chunk_buf(ctx, &bufsize);
+        size_t chunk = (nleft > (off_t)bufsize) ? bufsize : (size_t)nleft;
+
+        memset(buf, '\0', chunk);
+        if (!ctx->sink->zero && write_at(ctx, ctx->filepos, buf, chunk)) {
+            finish(ctx, RV_IOERROR);
+            return;
+        }
+        if (ctx->calc_digest)
+            hash(ctx, buf, chunk);
+        ctx->filepos += chunk;
+        report_progress(ctx, CATCH_RECEIVE);
+    } else {
+        /* Holes made by the sink are skipped at once. */
+        ctx->filepos = ctx->hole_end;
+        report_progress(ctx, CATCH_RECEIVE);
+        if (ctx->hole_end < ctx->extent_end)
+            enter(ctx, STATE_DATA, ctx->buf, 0);
+        else
+            enter(ctx, STATE_DIGEST, ctx->buf, sizeof(struct sha1));
+    }
+}
+
+static void copy_chunk(struct catch_context *ctx)
+{
+    off_t nleft = ctx->filelen - ctx->filepos;
+
+    if (nleft > 0) {
+        size_t chunk = (nleft > CATCH_COPYSIZE) ? CATCH_COPYSIZE : nleft;
+        size_t pos, len, bufsize;
+        unsigned char *buf = chunk_buf(ctx, &bufsize);
+        struct stats_mark mark;
+        int rv;
+
+        stats_start(ctx->stats, &mark);
+        rv = ctx->sink->copy_from(ctx->sink, ctx->filepos, ctx->srcfd, chunk);
+        stats_add(ctx->stats, STATS_WRITE, &mark, chunk);
+        if (rv) {
+            finish(ctx, RV_IOERROR);
+            return;
+        }
+
+        /* Hash what has actually been written as if it was received. */
+        for (pos = 0; ctx->calc_digest && pos < chunk; pos += len) {
+            len = (chunk - pos > bufsize) ? bufsize : chunk - pos;
+            if (read_at(ctx, ctx->filepos + pos, buf, len)) {
+                finish(ctx, RV_IOERROR);
+                return;
+            }
+            hash(ctx, buf, len);
+        }
+
+        ctx->filepos += chunk;
+        report_progress(ctx, CATCH_RECEIVE);
+    } else {
+        enter(ctx, STATE_DIGEST, ctx->buf, sizeof(struct sha1));
+    }
+}
+
+static void handle_digest(struct catch_context *ctx)
+{
+    struct sha1 digest;
+
+    SHA1Final((unsigned char *)&digest, &ctx->sha1_ctx);
+    if (ctx->calc_digest && memcmp(&digest, ctx->buf, sizeof digest))
+        reply(ctx, MSG_NACK, RV_COMPLETED_DIGEST_MISMATCH);
+    else
+        reply(ctx, MSG_ACK, 0);
+}
+
+/* Called once IO of the current state is complete to get to the next one. */
+static void step(struct catch_context *ctx)
+{
+    fpp_off_t fpp_off;
+    uint16_t namelen;
+
+    switch (ctx->state) {
+    case STATE_REQUEST:
+        if (ctx->buf[0] == MSG_PUSH || ctx->buf[0] == MSG_FORCED_PUSH ||
+            ctx->buf[0] == MSG_SPARSE_PUSH ||
+            ctx->buf[0] == MSG_FORCED_SPARSE_PUSH) {
+            ctx->forced = (ctx->buf[0] == MSG_FORCED_PUSH ||
+                           ctx->buf[0] == MSG_FORCED_SPARSE_PUSH);
+            ctx->extents = (ctx->buf[0] == MSG_SPARSE_PUSH ||
+                            ctx->buf[0] == MSG_FORCED_SPARSE_PUSH);
+            /* A file passed by the peer comes with the request type. */
+            if (ctx->tr->passed_fd)
+                ctx->srcfd = ctx->tr->passed_fd(ctx->tr);
+            enter(ctx, STATE_NAMELEN, ctx->buf, sizeof namelen);
+        } else {
+            finish(ctx, RV_UNEXPECTED);
+        }
+        break;
+    case STATE_NAMELEN:
+        memcpy(&namelen, ctx->buf, sizeof namelen);
+        namelen = ntohs(namelen);
+        if (namelen >= ctx->filenamesz)
+            finish(ctx, RV_UNEXPECTED);
+        else
+            enter(ctx, STATE_NAME, ctx->filename, namelen);
+        break;
+    case STATE_NAME:
+        ctx->filename[ctx->iolen] = '\0';
+        sanitize_filename(ctx->filename);
+        if (!ctx->forced) {
+            enter(ctx, STATE_OFFSET, ctx->buf, sizeof fpp_off);
+        } else {
+            ctx->fileoff = 0;
+            enter(ctx, STATE_FILELEN, ctx->buf, sizeof fpp_off);
+        }
+        break;
+    case STATE_OFFSET:
+        memcpy(&fpp_off, ctx->buf, sizeof fpp_off);
+        ctx->fileoff = to_off(ntoh_offset(fpp_off));
+        if (ctx->fileoff == -1)
+            reply(ctx, MSG_REJECT, RV_TOOBIG);
+        else
+            enter(ctx, STATE_FILELEN, ctx->buf, sizeof fpp_off);
+        break;
+    case STATE_FILELEN:
+        handle_filelen(ctx);
+        break;
+    case STATE_ACCEPT:
+        handle_accept(ctx);
+        break;
+    case STATE_RESUME_SHA1:
+        resume_sha1(ctx);
+        break;
+    case STATE_RESUME_DIGEST:
+        handle_resume_digest(ctx);
+        break;
+    case STATE_RESUME_ACK:
+        receive_data(ctx);
+        break;
+    case STATE_DATA:
+        receive_chunk(ctx);
+        break;
+    case STATE_EXTENT:
+        handle_extent(ctx);
+        break;
+    case STATE_HOLE:
+        fill_hole(ctx);
+        break;
+    case STATE_COPY:
+        copy_chunk(ctx);
+        break;
+    case STATE_DIGEST:
+        handle_digest(ctx);
+        break;
+    case STATE_REPLY:
+        finish(ctx, ctx->rv);
+        break;
+    }
+}
+
+void libcatch_begin(struct catch_context *ctx)
+{
+    ctx->filepos = 0;
+    ctx->rv = 0;
+    ctx->sink_open = 0;
+    ctx->srcfd = -1;
+    enter(ctx, STATE_REQUEST, ctx->buf, sizeof(fpp_msg_t));
+}
+
+int libcatch_continue(struct catch_context *ctx)
+{
+    while (ctx->state != STATE_DONE) {
+        if (*ctx->terminate) {
+            finish(ctx, RV_TERMINATED);
+        } else if (ctx->iopos < ctx->iolen) {
+            unsigned char *ptr = ctx->io + ctx->iopos;
+            size_t len = ctx->iolen - ctx->iopos;
+            size_t n = 0;
+            int sending = is_sending(ctx->state);
+            struct stats_mark mark;
+            int rv;
+
+            stats_start(ctx->stats, &mark);
+            rv = sending ? ctx->tr->send(ctx->tr, ptr, len, &n)
+                         : ctx->tr->recv(ctx->tr, ptr, len, &n);
+            stats_add(ctx->stats, STATS_NET, &mark, n);
+
+            if (rv == RV_WOULDBLOCK)
+                return sending ? CATCH_WANT_WRITE : CATCH_WANT_READ;
+            else if (rv)
+                finish(ctx, rv);
+            else
+                ctx->iopos += n;
+        } else {
+            step(ctx);
+        }
+    }
+    return CATCH_DONE;
+}
+
+int libcatch_handle_request(struct catch_context *ctx)
+{
+    int status;
+
+    libcatch_begin(ctx);
+    while ((status = libcatch_continue(ctx)) != CATCH_DONE) {
+        /* Non-blocking transports are waited for, not spun on. */
+        if (ctx->tr->wait) {
+            int rv = ctx->tr->wait(ctx->tr, status == CATCH_WANT_WRITE);
+            if (rv)
+                finish(ctx, rv);
+        }
+    }
+    return ctx->rv;
 }
@@ -2,24 +2,51 @@
 #define LIBCATCH_H
 
 #include "platform.h"
+#include "progress.h"
+#include "retval.h"
+#include "sha1.h"
+#include "sink.h"
+#include "stats.h"
+#include "transport.h"
 #include <stdio.h>
 #include <signal.h>
 
+#define CATCH_BUFSIZE 512
+#define CATCH_COPYSIZE 32768 /* chunk size of copying from passed files */
+
 struct catch_context {
     char *filename;    /* application-provided buffer */
     size_t filenamesz; /* and its size */
-    FILE *fp;
+    struct sink *sink;
     off_t fileoff;
     off_t filepos;
     off_t filelen;
-    Sock sk;
+    struct transport *tr;
+    size_t chunksize;          /* most content received at once */
+    unsigned char *chunkbuf;   /* into this buffer or NULL */
     int calc_digest;
     int allow_forced;
     int forced;
+    struct xfer_stats *stats;  /* counters to accumulate into or NULL */
     volatile sig_atomic_t *terminate;
     void (*on_stage_change)(const struct catch_context *ctx, int stage);
     void (*on_progress)(const struct catch_context *ctx, int stage);
+    struct progress progress;  /* of the stage reported to on_progress */
     int (*confirm_file)(const struct catch_context *ctx);
+
+    /* Private state of the request, initialized by libcatch_begin(). */
+    int state;
+    int rv;
+    int sink_open;         /* the sink is to be finalized */
+    int srcfd;             /* file passed by the peer to copy from or -1 */
+    int extents;           /* content comes as extents of data */
+    off_t hole_end;        /* start of the next extent */
+    off_t extent_end;      /* end of the current extent (or the content) */
+    SHA1_CTX sha1_ctx;
+    unsigned char *io;     /* buffer of the pending send or receive */
+    size_t iolen;          /* and its size */
+    size_t iopos;          /* number of bytes already transferred */
+    unsigned char buf[CATCH_BUFSIZE];
 };
 
 enum catch_stage {
@@ -28,14 +55,42 @@ enum catch_stage {
     CATCH_SHA1_CALC
 };
 
+enum catch_status {
+    CATCH_DONE,
+    CATCH_WANT_READ,
+    CATCH_WANT_WRITE
+};
+
+/* on_progress() is called as ctx->progress describes, with the counters
+ * filled in. Only the intervals of ctx->progress are to be set by the
+ * application, libcatch takes care of the rest.
+ *
+ * Content is received into chunkbuf of chunksize bytes if provided,
+ * otherwise into an internal buffer of CATCH_BUFSIZE bytes. Bigger chunks
+ * mean fewer system calls on fast links. Holes left out by the peer are
+ * recreated with zero() of the sink if it has one. */
+
+/* Handle one request over ctx->tr, waiting for the transport with its
+ * wait() if it is non-blocking. Requests do not share any state, so
+ * different threads may handle requests over different transports at once,
+ * each cancelled by its own ctx->terminate. */
 int libcatch_handle_request(struct catch_context *ctx);
 
+/* Incremental interface for catching over non-blocking transports.
+ *
+ * libcatch_begin() prepares the context for handling of the next request,
+ * then libcatch_continue() must be called every time ctx->tr becomes ready
+ * for the returned direction of IO until it returns CATCH_DONE. The result
+ * is then available in ctx->rv, just as libcatch_handle_request() would
+ * return it. The function never waits for the transport, but it still
+ * accesses the sink synchronously. */
+void libcatch_begin(struct catch_context *ctx);
+int libcatch_continue(struct catch_context *ctx);
+
 /* Application must define type Sock and implement these functions. */
 // uint16_t htons(uint16_t hostshort);
 // uint16_t ntohs(uint16_t netshort);
 extern int get_filelen(const char *filename, off_t *filelen);
 extern void sanitize_filename(char *filename);
-extern int send_entire(Sock sk, const void *buf, size_t len);
-extern int recv_entire(Sock sk, void *buf, size_t len);
 
 #endif
@@ -8,185 +8,512 @@
 #include "sha1.h"
 #include "sha1util.h"
 
-#define BLOCKSIZE 512
+/* Message type and name length are the head of a push request,
+ * offset (for non-forced pushes) and file length are its tail. */
+#define REQUEST_HEADLEN (sizeof(fpp_msg_t) + sizeof(uint16_t))
+#define REQUEST_TAILLEN(ctx) \
+    (((ctx)->forced ? 1 : 2) * sizeof(fpp_off_t))
+
+enum push_state {
+    STATE_REQUEST,        /* sending push request */
+    STATE_REPLY,          /* receiving reply to the push request */
+    STATE_OFFSET,         /* receiving offset of MSG_REJECT_OFFSET */
+    STATE_RESUME_SHA1,    /* calculating digest of the initial part */
+    STATE_RESUME_DIGEST,  /* sending digest of the initial part */
+    STATE_RESUME_REPLY,   /* receiving reply to that digest */
+    STATE_DATA,           /* sending content of the file */
+    STATE_HOLE,           /* hashing zeros of a hole left out */
+    STATE_EXTENT,         /* sending header of the next extent of data */
+    STATE_DIGEST,         /* sending digest of the entire file (after
+                             the last chunk of the content) */
+    STATE_ACK,            /* receiving final reply */
+    STATE_DONE
+};
+
+static int is_receiving(int state)
+{
+    return state == STATE_REPLY || state == STATE_OFFSET ||
+           state == STATE_RESUME_REPLY || state == STATE_ACK;
+}
 
-static int push_chunk(struct push_context *ctx, SHA1_CTX *sha1_ctx)
+/* Switch to the state, which starts with transfer of len bytes of buf. */
+static void enter(struct push_context *ctx, int state, const void *buf,
+                  size_t len)
 {
-    int rv = 0;
-    fpp_msg_t rsp;
-    struct sha1 digest;
-    off_t nleft = ctx->filelen - ctx->filepos;
+    ctx->state = state;
+    ctx->io[0].base = buf;
+    ctx->io[0].len = len;
+    ctx->iocnt = 1;
+    ctx->iolen = len;
+    ctx->iopos = 0;
+    ctx->more = 0;
+}
 
-    while (nleft > 0) {
-        unsigned char buf[BLOCKSIZE];
-        size_t chunk = (nleft > BLOCKSIZE) ? BLOCKSIZE : nleft;
+/* Add another buffer to be sent along with the previous ones. */
+static void append(struct push_context *ctx, const void *buf, size_t len)
+{
+    ctx->io[ctx->iocnt].base = buf;
+    ctx->io[ctx->iocnt].len = len;
+    ctx->iocnt++;
+    ctx->iolen += len;
+}
 
-        if (fread(buf, 1, chunk, ctx->fp) != chunk)
-            return RV_IOERROR;
+static void finish(struct push_context *ctx, int rv)
+{
+    ctx->rv = rv;
+    enter(ctx, STATE_DONE, NULL, 0);
+}
 
-        rv = send_entire(ctx->sk, buf, chunk);
-        if (rv)
-            return rv;
+/* Tell whether there are holes worth leaving out of the content to send. */
+static int has_holes(struct push_context *ctx)
+{
+    struct source *src = ctx->src;
+    off_t start, end;
+
+    if (!ctx->sparse || !src->find_data || ctx->fileoff >= ctx->filelen)
+        return 0;
+    if (src->find_data(src, ctx->fileoff, &start, &end) != 0)
+        return 0;
+    return start > ctx->fileoff || end < ctx->filelen;
+}
 
-        if (ctx->calc_digest)
-            SHA1Update(sha1_ctx, buf, chunk);
+static void send_request(struct push_context *ctx)
+{
+    fpp_msg_t msg;
+    uint16_t namelen = strlen(ctx->filename);
+    uint16_t be_namelen = htons(namelen);
+    fpp_off_t be_fileoff = hton_offset(to_fpp_off(ctx->fileoff));
+    fpp_off_t be_filelen = hton_offset(to_fpp_off(ctx->filelen));
+    size_t reqlen = REQUEST_HEADLEN + namelen + REQUEST_TAILLEN(ctx);
+    unsigned char *p = ctx->buf;
 
-        nleft -= chunk;
-        ctx->filepos += chunk;
+    /* The peer may copy the content from the file itself if it gets it. */
+    ctx->fd_passed = ctx->tr->pass_fd && ctx->src->fd >= 0 &&
+                     ctx->tr->pass_fd(ctx->tr, ctx->src->fd) == 0;
 
-        if (*ctx->terminate)
-            return RV_TERMINATED;
-    }
+    /* Otherwise, holes may be left out of the content. */
+    ctx->extents = !ctx->fd_passed && has_holes(ctx);
+    ctx->extent_end = ctx->extents ? ctx->fileoff : ctx->filelen;
 
-    /* Once transmission of file is completed, we must send our digest,
-     * so the peer can ensure that the transmission was correct. */
-    if (ctx->calc_digest)
-        SHA1Final((unsigned char *)&digest, sha1_ctx);
+    if (ctx->extents)
+        msg = ctx->forced ? MSG_FORCED_SPARSE_PUSH : MSG_SPARSE_PUSH;
     else
-        memset(&digest, '\0', sizeof digest);
+        msg = ctx->forced ? MSG_FORCED_PUSH : MSG_PUSH;
+
+    memcpy(p, &msg, sizeof msg);
+    p += sizeof msg;
+    memcpy(p, &be_namelen, sizeof be_namelen);
+    p += sizeof be_namelen;
+
+    /* Usually the whole request fits the buffer. Otherwise, the name is
+     * sent from where it is between head and tail of the request. */
+    if (reqlen <= sizeof ctx->buf) {
+        memcpy(p, ctx->filename, namelen);
+        p += namelen;
+    }
+    if (!ctx->forced) {
+        memcpy(p, &be_fileoff, sizeof be_fileoff);
+        p += sizeof be_fileoff;
+    }
+    memcpy(p, &be_filelen, sizeof be_filelen);
+
+    if (reqlen <= sizeof ctx->buf) {
+        enter(ctx, STATE_REQUEST, ctx->buf, reqlen);
+    } else {
+        enter(ctx, STATE_REQUEST, ctx->buf, REQUEST_HEADLEN);
+        append(ctx, ctx->filename, namelen);
+        append(ctx, ctx->buf + REQUEST_HEADLEN, REQUEST_TAILLEN(ctx));
+    }
+}
 
-    rv = send_entire(ctx->sk, &digest, sizeof digest);
-    if (rv)
-        return rv;
+static void finish_digest(struct push_context *ctx)
+{
+    if (ctx->calc_digest) {
+        SHA1_CTX tmp_sha1_ctx = ctx->sha1_ctx;
+        SHA1Final(ctx->digest.value, &tmp_sha1_ctx);
+    } else {
+        memset(&ctx->digest, '\0', sizeof ctx->digest);
+    }
+}
 
-    rv = recv_entire(ctx->sk, &rsp, sizeof rsp);
-    if (rv)
-        return rv;
+static void send_digest(struct push_context *ctx, int state)
+{
+    finish_digest(ctx);
+    enter(ctx, state, ctx->digest.value, sizeof ctx->digest);
+}
 
-    if (rsp == MSG_NACK)
-        rv = RV_NACK;
-    else if (rsp == MSG_ACK)
-        rv = 0;
-    else
-        rv = RV_UNEXPECTED;
+static void hash(struct push_context *ctx, const void *buf, size_t len)
+{
+    struct stats_mark mark;
 
-    return rv;
+    stats_start(ctx->stats, &mark);
+    SHA1Update(&ctx->sha1_ctx, buf, len);
+    stats_add(ctx->stats, STATS_HASH, &mark, len);
 }
 
-static int send_push_request(struct push_context *ctx)
+/* Get the buffer for content and its size. */
+static unsigned char *chunk_buf(struct push_context *ctx, size_t *size)
 {
-    fpp_msg_t msg = ctx->forced ? MSG_FORCED_PUSH : MSG_PUSH;
-    uint16_t namelen = strlen(ctx->filename);
-    uint16_t be_namelen = htons(namelen);
-    fpp_off_t be_fileoff = hton_offset(to_fpp_off(ctx->fileoff));
-    fpp_off_t be_filelen = hton_offset(to_fpp_off(ctx->filelen));
+    if (ctx->chunkbuf && ctx->chunksize) {
+        *size = ctx->chunksize;
+        return ctx->chunkbuf;
+    }
+    *size = PUSH_BUFSIZE;
+    return ctx->buf;
+}
+
+/* Get next chunk of the source at ctx->filepos, but not beyond end.
+ * Mapped sources hand out their memory, others are read into a buffer. */
+static unsigned char *read_chunk(struct push_context *ctx, off_t end,
+                                 size_t *chunk)
+{
+    struct source *src = ctx->src;
+    off_t nleft = end - ctx->filepos;
+    struct stats_mark mark;
+    unsigned char *buf;
+    size_t bufsize;
     int rv;
 
-    rv = send_entire(ctx->sk, &msg, sizeof msg);
-    if (rv)
-        return rv;
-    rv = send_entire(ctx->sk, &be_namelen, sizeof be_namelen);
-    if (rv)
-        return rv;
-    rv = send_entire(ctx->sk, ctx->filename, namelen);
-    if (rv)
-        return rv;
-    if (msg == MSG_PUSH) {
-        rv = send_entire(ctx->sk, &be_fileoff, sizeof be_fileoff);
-        if (rv)
-            return rv;
+    if (src->map) {
+        const void *data;
+        size_t mapsize = ctx->chunksize ? ctx->chunksize : PUSH_MAPSIZE;
+        *chunk = (nleft > (off_t)mapsize) ? mapsize : (size_t)nleft;
+        stats_start(ctx->stats, &mark);
+        data = src->map(src, ctx->filepos, *chunk);
+        if (data) {
+            /* Page faults count for whatever touches the memory first. */
+            stats_add(ctx->stats, STATS_READ, &mark, *chunk);
+            return (unsigned char *)data; /* only ever sent */
+        }
     }
-    rv = send_entire(ctx->sk, &be_filelen, sizeof be_filelen);
-    return rv;
+
+    buf = chunk_buf(ctx, &bufsize);
+    *chunk = (nleft > (off_t)bufsize) ? bufsize : (size_t)nleft;
+    stats_start(ctx->stats, &mark);
+    rv = src->read_at(src, ctx->filepos, buf, *chunk);
+    stats_add(ctx->stats, STATS_READ, &mark, *chunk);
+    return (rv == 0) ? buf : NULL;
 }
 
-int libpush_push_file(struct push_context *ctx)
+/* Report progress of the stage if it is due. */
+static void report_progress(struct push_context *ctx, int stage)
 {
-    fpp_msg_t msg;
-    int rv;
+    if (ctx->on_progress && progress_update(&ctx->progress, ctx->filepos))
+        ctx->on_progress(ctx, stage);
+}
 
-    ctx->filepos = 0;
+static void resume_sha1(struct push_context *ctx)
+{
+    if (ctx->filepos < ctx->fileoff) {
+        size_t chunk;
+        unsigned char *data = read_chunk(ctx, ctx->fileoff, &chunk);
+
+        if (!data) {
+            finish(ctx, RV_IOERROR);
+        } else {
+            hash(ctx, data, chunk);
+            ctx->filepos += chunk;
+            report_progress(ctx, PUSH_SHA1_CALC);
+        }
+    } else {
+        send_digest(ctx, STATE_RESUME_DIGEST);
+    }
+}
 
-    rv = send_push_request(ctx);
-    if (rv)
-        return rv;
+/* Find the next extent of data, the hole before it is hashed first. */
+static void next_extent(struct push_context *ctx)
+{
+    off_t start = ctx->filelen, end = ctx->filelen;
 
-    rv = recv_entire(ctx->sk, &msg, sizeof msg);
-    if (rv)
-        return rv;
+    if (ctx->filepos < ctx->filelen &&
+        ctx->src->find_data(ctx->src, ctx->filepos, &start, &end) != 0) {
+        finish(ctx, RV_IOERROR);
+        return;
+    }
 
-    if (msg == MSG_REJECT) {
-        rv = RV_REJECT;
-    } else if (msg == MSG_ACCEPT) {
-        SHA1_CTX sha1_ctx;
-        SHA1Init(&sha1_ctx);
-
-        if (ctx->fileoff) {
-            if (ctx->calc_digest) {
-                /* Calculate our digest */
-                off_t nleft = ctx->fileoff;
-
-                if (ctx->on_stage_change)
-                    ctx->on_stage_change(ctx, PUSH_SHA1_CALC);
-
-                while (nleft > 0) {
-                    unsigned char buf[BLOCKSIZE];
-                    size_t chunk = (nleft > BLOCKSIZE) ? BLOCKSIZE : nleft;
-                    if (fread(buf, 1, chunk, ctx->fp) != chunk) {
-                        return RV_IOERROR;
-                    } else {
-                        SHA1Update(&sha1_ctx, buf, chunk);
-                        nleft -= chunk;
-                        ctx->filepos += chunk;
-                    }
-                    if (*ctx->terminate)
-                        return RV_TERMINATED;
-                }
-            } else {
-                ctx->filepos = ctx->fileoff;
-            }
-
-            /* Send our digest */ {
-                struct sha1 digest;
-                if (ctx->calc_digest) {
-                    SHA1_CTX tmp_sha1_ctx = sha1_ctx;
-                    SHA1Final((unsigned char *)&digest, &tmp_sha1_ctx);
-                } else {
-                    memset(&digest, '\0', sizeof digest);
-                }
-
-                rv = send_entire(ctx->sk, &digest, sizeof digest);
-                if (rv)
-                    return rv;
-            }
-
-            rv = recv_entire(ctx->sk, &msg, sizeof msg);
-            if (rv)
-                return rv;
-
-            if (msg == MSG_NACK) {
-                return RV_RESUME_NACK;
-            } else if (msg == MSG_ACK && ctx->fileoff == ctx->filelen) {
-                return RV_RESUME_ACK;
-            } else if (msg != MSG_ACK) {
-                return RV_UNEXPECTED;
-            }
+    if (start > ctx->filelen)
+        start = ctx->filelen;
+    if (end > ctx->filelen)
+        end = ctx->filelen;
+    if (start < ctx->filepos || (end <= start && start < ctx->filelen)) {
+        finish(ctx, RV_IOERROR);
+        return;
+    }
+
+    ctx->hole_end = start;
+    ctx->extent_end = end;
+    enter(ctx, STATE_HOLE, ctx->buf, 0);
+}
+
+static void skip_hole(struct push_context *ctx)
+{
+    off_t nleft = ctx->hole_end - ctx->filepos;
+    fpp_off_t be_start, be_len;
+
+    if (nleft > 0 && ctx->calc_digest) {
+        size_t bufsize;
+        unsigned char *buf = chunk_buf(ctx, &bufsize);
+        size_t chunk = (nleft > (off_t)bufsize) ? bufsize : (size_t)nleft;
+
+        memset(buf, '\0', chunk);
+        hash(ctx, buf, chunk);
+        ctx->filepos += chunk;
+        report_progress(ctx, PUSH_SEND);
+        return;
+    }
+
+    ctx->filepos = ctx->hole_end;
+    report_progress(ctx, PUSH_SEND);
+    be_start = hton_offset(to_fpp_off(ctx->hole_end));
+    be_len = hton_offset(to_fpp_off(ctx->extent_end - ctx->hole_end));
+    memcpy(ctx->buf, &be_start, sizeof be_start);
+    memcpy(ctx->buf + sizeof be_start, &be_len, sizeof be_len);
+
+    if (ctx->extent_end > ctx->hole_end) {
+        enter(ctx, STATE_EXTENT, ctx->buf, 2 * sizeof(fpp_off_t));
+        ctx->more = 1;
+    } else {
+        /* The empty extent at the end goes out along with the digest. */
+        finish_digest(ctx);
+        enter(ctx, STATE_DIGEST, ctx->buf, 2 * sizeof(fpp_off_t));
+        append(ctx, ctx->digest.value, sizeof ctx->digest);
+    }
+}
+
+static void send_data(struct push_context *ctx)
+{
+    /* The previous chunk (if any) has been sent by now. */
+    ctx->filepos += ctx->iolen;
+
+    if (ctx->fd_copied && !ctx->calc_digest)
+        ctx->filepos = ctx->filelen;
+    report_progress(ctx, PUSH_SEND);
+
+    if (ctx->extents && ctx->filepos >= ctx->extent_end) {
+        next_extent(ctx);
+    } else if (ctx->filepos < ctx->extent_end) {
+        size_t chunk;
+        unsigned char *data = read_chunk(ctx, ctx->extent_end, &chunk);
+
+        if (!data) {
+            finish(ctx, RV_IOERROR);
+            return;
         }
 
-        if (ctx->fileoff && ctx->on_stage_change)
-            ctx->on_stage_change(ctx, PUSH_RESUME);
+        if (ctx->calc_digest)
+            hash(ctx, data, chunk);
+
+        if (ctx->fd_copied) {
+            /* The content is only hashed, the peer copies it. */
+            ctx->filepos += chunk;
+            enter(ctx, STATE_DATA, ctx->buf, 0);
+        } else if (ctx->extents ||
+                   ctx->filepos + (off_t)chunk < ctx->filelen) {
+            enter(ctx, STATE_DATA, data, chunk);
+            ctx->more = 1;
+        } else {
+            /* The digest goes out along with the last chunk, rather than
+             * in a small segment of its own. */
+            finish_digest(ctx);
+            enter(ctx, STATE_DIGEST, data, chunk);
+            append(ctx, ctx->digest.value, sizeof ctx->digest);
+        }
+    } else {
+        /* Once transmission of file is completed, we must send our digest,
+         * so the peer can ensure that the transmission was correct. */
+        send_digest(ctx, STATE_DIGEST);
+    }
+}
+
+static void send_content(struct push_context *ctx)
+{
+    progress_start(&ctx->progress, ctx->filepos, ctx->filelen);
+    enter(ctx, STATE_DATA, ctx->buf, 0);
+}
 
-        rv = push_chunk(ctx, &sha1_ctx);
+static void handle_reply(struct push_context *ctx, fpp_msg_t msg)
+{
+    if (msg == MSG_REJECT) {
+        finish(ctx, RV_REJECT);
+    } else if (msg == MSG_ACCEPT || (msg == MSG_ACCEPT_FD && ctx->fd_passed)) {
+        ctx->fd_copied = (msg == MSG_ACCEPT_FD);
+        SHA1Init(&ctx->sha1_ctx);
+
+        if (!ctx->fileoff) {
+            send_content(ctx);
+        } else if (ctx->calc_digest) {
+            if (ctx->on_stage_change)
+                ctx->on_stage_change(ctx, PUSH_SHA1_CALC);
+            progress_start(&ctx->progress, 0, ctx->fileoff);
+            enter(ctx, STATE_RESUME_SHA1, ctx->buf, 0);
+        } else {
+            ctx->filepos = ctx->fileoff;
+            send_digest(ctx, STATE_RESUME_DIGEST);
+        }
     } else if (msg == MSG_REJECT_OFFSET && !ctx->forced && ctx->fileoff == 0) {
         /* Peer indicated that it already has our file. */
-        fpp_off_t fpp_off;
-        off_t fileoff;
-
-        rv = recv_entire(ctx->sk, &fpp_off, sizeof fpp_off);
-        if (rv)
-            return rv;
+        enter(ctx, STATE_OFFSET, ctx->buf, sizeof(fpp_off_t));
+    } else if (msg == MSG_ACK && ctx->fileoff == 0 && ctx->filelen == 0) {
+        finish(ctx, RV_RESUME_ACK);
+    } else {
+        finish(ctx, RV_UNEXPECTED);
+    }
+}
 
-        fileoff = to_off(ntoh_offset(fpp_off));
+static void handle_offset(struct push_context *ctx)
+{
+    fpp_off_t fpp_off;
+    off_t fileoff;
 
-        if (fileoff == -1 || fileoff == 0 || fileoff > ctx->filelen)
-            return RV_UNEXPECTED;
+    memcpy(&fpp_off, ctx->buf, sizeof fpp_off);
+    fileoff = to_off(ntoh_offset(fpp_off));
 
+    if (fileoff == -1 || fileoff == 0 || fileoff > ctx->filelen) {
+        finish(ctx, RV_UNEXPECTED);
+    } else {
+        /* Start over offering the rest of the file. */
         ctx->fileoff = fileoff;
-        rv = libpush_push_file(ctx);
-    } else if (msg == MSG_ACK && ctx->fileoff == 0 && ctx->filelen == 0) {
-        rv = RV_RESUME_ACK;
+        libpush_begin(ctx);
+    }
+}
+
+static void handle_resume_reply(struct push_context *ctx, fpp_msg_t msg)
+{
+    if (msg == MSG_NACK) {
+        finish(ctx, RV_RESUME_NACK);
+    } else if (msg == MSG_ACK && ctx->fileoff == ctx->filelen) {
+        finish(ctx, RV_RESUME_ACK);
+    } else if (msg != MSG_ACK) {
+        finish(ctx, RV_UNEXPECTED);
     } else {
-        rv = RV_UNEXPECTED;
+        if (ctx->on_stage_change)
+            ctx->on_stage_change(ctx, PUSH_RESUME);
+        send_content(ctx);
+    }
+}
+
+/* Called once IO of the current state is complete to get to the next one. */
+static void step(struct push_context *ctx)
+{
+    switch (ctx->state) {
+    case STATE_REQUEST:
+        enter(ctx, STATE_REPLY, ctx->buf, sizeof(fpp_msg_t));
+        break;
+    case STATE_REPLY:
+        handle_reply(ctx, ctx->buf[0]);
+        break;
+    case STATE_OFFSET:
+        handle_offset(ctx);
+        break;
+    case STATE_RESUME_SHA1:
+        resume_sha1(ctx);
+        break;
+    case STATE_RESUME_DIGEST:
+        enter(ctx, STATE_RESUME_REPLY, ctx->buf, sizeof(fpp_msg_t));
+        break;
+    case STATE_RESUME_REPLY:
+        handle_resume_reply(ctx, ctx->buf[0]);
+        break;
+    case STATE_DATA:
+        send_data(ctx);
+        break;
+    case STATE_HOLE:
+        skip_hole(ctx);
+        break;
+    case STATE_EXTENT:
+        enter(ctx, STATE_DATA, ctx->buf, 0);
+        break;
+    case STATE_DIGEST:
+        ctx->filepos = ctx->filelen;
+        report_progress(ctx, PUSH_SEND);
+        enter(ctx, STATE_ACK, ctx->buf, sizeof(fpp_msg_t));
+        break;
+    case STATE_ACK:
+        if (ctx->buf[0] == MSG_NACK)
+            finish(ctx, RV_NACK);
+        else if (ctx->buf[0] == MSG_ACK)
+            finish(ctx, 0);
+        else
+            finish(ctx, RV_UNEXPECTED);
+        break;
+    }
+}
+
+/* Transfer as much of the pending IO as the transport takes at once. */
+static int transfer(struct push_context *ctx, size_t *n)
+{
+    struct tr_iovec iov[TR_IOVMAX];
+    size_t skip = ctx->iopos;
+    int i, cnt = 0;
+
+    if (is_receiving(ctx->state)) {
+        unsigned char *ptr = (unsigned char *)ctx->io[0].base + skip;
+        return ctx->tr->recv(ctx->tr, ptr, ctx->iolen - skip, n);
+    }
+
+    for (i = 0; i < ctx->iocnt; i++) {
+        if (skip >= ctx->io[i].len) {
+            skip -= ctx->io[i].len;
+        } else {
+            iov[cnt].base = (const unsigned char *)ctx->io[i].base + skip;
+            iov[cnt].len = ctx->io[i].len - skip;
+            skip = 0;
+            cnt++;
+        }
+    }
+
+    if (ctx->tr->sendv)
+        return ctx->tr->sendv(ctx->tr, iov, cnt, ctx->more, n);
+    return ctx->tr->send(ctx->tr, iov[0].base, iov[0].len, n);
+}
+
+void libpush_begin(struct push_context *ctx)
+{
+    ctx->filepos = 0;
+    ctx->rv = 0;
+    send_request(ctx);
+}
+
+int libpush_continue(struct push_context *ctx)
+{
+    while (ctx->state != STATE_DONE) {
+        if (*ctx->terminate) {
+            finish(ctx, RV_TERMINATED);
+        } else if (ctx->iopos < ctx->iolen) {
+            struct stats_mark mark;
+            size_t n = 0;
+            int rv;
+
+            stats_start(ctx->stats, &mark);
+            rv = transfer(ctx, &n);
+            stats_add(ctx->stats, STATS_NET, &mark, n);
+
+            if (rv == RV_WOULDBLOCK)
+                return is_receiving(ctx->state) ? PUSH_WANT_READ
+                                                : PUSH_WANT_WRITE;
+            else if (rv)
+                finish(ctx, rv);
+            else
+                ctx->iopos += n;
+        } else {
+            step(ctx);
+        }
+    }
+    return PUSH_DONE;
+}
+
+int libpush_push_file(struct push_context *ctx)
+{
+    int status;
+
+    libpush_begin(ctx);
+    while ((status = libpush_continue(ctx)) != PUSH_DONE) {
+        /* Non-blocking transports are waited for, not spun on. */
+        if (ctx->tr->wait) {
+            int rv = ctx->tr->wait(ctx->tr, status == PUSH_WANT_WRITE);
+            if (rv)
+                finish(ctx, rv);
+        }
     }
-    return rv;
+    return ctx->rv;
 }
@@ -2,29 +2,97 @@
 #define LIBPUSH_H
 
 #include "platform.h"
+#include "progress.h"
+#include "retval.h"
+#include "sha1.h"
+#include "sha1util.h"
+#include "source.h"
+#include "stats.h"
+#include "transport.h"
 #include <stdio.h>
 #include <signal.h>
 
+#define PUSH_BUFSIZE 512
+#define PUSH_MAPSIZE 32768 /* default chunk size of sources with map() */
+
 struct push_context {
     const char *filename;
-    FILE *fp;
+    struct source *src;
     off_t fileoff;
     off_t filepos;
     off_t filelen;
-    Sock sk;
+    struct transport *tr;
+    size_t chunksize;          /* most content sent at once or 0 */
+    unsigned char *chunkbuf;   /* buffer of chunksize bytes or NULL */
     int calc_digest;
     int forced;
+    int sparse;                /* leave out holes the source can find */
+    struct xfer_stats *stats;  /* counters to accumulate into or NULL */
     volatile sig_atomic_t *terminate;
     void (*on_stage_change)(const struct push_context *ctx, int stage);
+    void (*on_progress)(const struct push_context *ctx, int stage);
+    struct progress progress;  /* of the stage reported to on_progress */
+
+    /* Private state of the push, initialized by libpush_begin(). */
+    int state;
+    int rv;
+    int fd_passed;         /* descriptor of the source went with request */
+    int fd_copied;         /* and the peer copies the content from it */
+    int extents;           /* content is sent as extents of data */
+    off_t hole_end;        /* start of the next extent */
+    off_t extent_end;      /* end of the current extent (or the content) */
+    SHA1_CTX sha1_ctx;
+    struct tr_iovec io[TR_IOVMAX]; /* buffers of the pending IO */
+    int iocnt;             /* their number */
+    size_t iolen;          /* and total size */
+    size_t iopos;          /* number of bytes already transferred */
+    int more;              /* more data follow the pending send */
+    struct sha1 digest;
+    unsigned char buf[PUSH_BUFSIZE];
 };
 
 enum push_stage {
     PUSH_SHA1_CALC,
-    PUSH_RESUME
+    PUSH_RESUME,
+    PUSH_SEND       /* content being sent, only reported to on_progress */
+};
+
+enum push_status {
+    PUSH_DONE,
+    PUSH_WANT_READ,
+    PUSH_WANT_WRITE
 };
 
+/* Content of sources supporting map() is sent in chunks of chunksize bytes
+ * (PUSH_MAPSIZE by default). Content of other sources is read into chunkbuf
+ * if provided, otherwise into an internal buffer of PUSH_BUFSIZE bytes.
+ * Bigger chunks mean fewer system calls on fast links.
+ *
+ * With sparse set, holes found by find_data() of the source are not sent,
+ * the peer recreates them from offsets of the extents of data. Digests are
+ * still those of the whole content, zeros of the holes included.
+ *
+ * on_progress() is called as ctx->progress describes, with the counters
+ * filled in. Only the intervals of ctx->progress are to be set by the
+ * application, libpush takes care of the rest. */
+
+/* Push the file in one go, waiting for the transport with its wait() if it
+ * is non-blocking.
+ *
+ * Pushes do not share any state, so different threads may push over
+ * different transports at once, each cancelled by its own ctx->terminate. */
 int libpush_push_file(struct push_context *ctx);
 
+/* Incremental interface for pushing over non-blocking transports.
+ *
+ * libpush_begin() prepares the context for pushing of the file, then
+ * libpush_continue() must be called every time ctx->tr becomes ready for
+ * the returned direction of IO until it returns PUSH_DONE. The result
+ * (0 or one of RV_* values) is then available in ctx->rv. The function
+ * never waits for the transport, but it still reads the source synchronously. */
+void libpush_begin(struct push_context *ctx);
+int libpush_continue(struct push_context *ctx);
+
 /* The application must provide the following as functions or macros. */
 
 /* Convert fpp_off_t to off_t, return -1 on overflow. */
@@ -1,19 +1,68 @@
+#define _GNU_SOURCE /* recvmmsg(), sendmmsg() */
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/statvfs.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "common.h"
+#include "discovery.h"
+#include "events.h"
+#include "fdio.h"
+#include "ifaces.h"
 #include "libcatch.h"
+#include "metrics.h"
+#include "tune.h"
+#include "unixsock.h"
 
 static char myname[PEERNAME_MAX+1];
 static int allow_forced;
+static size_t bufsize;
+static unsigned long rate = TUNE_RATE;
+static int show_stats;
+static int calc_digest = 1;
+
+/* Progress of the current connection for the metrics and events. */
+static double accepted_at;     /* or 0 once its first request came */
+static double receive_started; /* or 0 if no content has come yet */
+static off_t received_pos;
+
+/* Load reported in replies to discovery, which are sent by a thread of
+ * their own, so catch answers during transfers too. Content received is
+ * counted in windows of INGEST_WINDOW seconds, and the rate is estimated
+ * over the last such period from the current window and the part of the
+ * previous one. */
+#define INGEST_WINDOW 10.0
+static pthread_mutex_t status_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int transfers; /* connections being served */
+static double ingest_started;  /* the current window */
+static double ingest_cur, ingest_prev;
+
+/* Discovery requests are answered in batches, and every source is answered
+ * LIMIT_BURST times at once and LIMIT_RATE times per second at most. */
+#define DISCOVERY_BATCH 64
+#define STATUS_SECS 0.1        /* a reply of version 2 is reused */
+#define LIMIT_SLOTS 256
+#define LIMIT_BURST 10.0
+#define LIMIT_RATE 20.0
+
+struct request {
+    unsigned char buf[DISCOVERY_REQ_LEN];
+    size_t len;
+    struct sockaddr_storage ss;
+    socklen_t ss_len;
+    const unsigned char *reply;
+    size_t replylen;
+};
 
 static void signal_handler(int signum)
 {
@@ -21,25 +70,300 @@ static void signal_handler(int signum)
     terminate = 1;
 }
 
-static void handle_discovery(int fd)
+static double now(void)
 {
-    uint8_t req;
-    struct sockaddr_storage ss;
-    socklen_t ss_len = sizeof ss;
-    size_t namelen = strlen(myname);
-    char buf[PEERNAME_MAX+1];
-    buf[0] = namelen;
-    memcpy(&buf[1], myname, namelen);
-    if (recvfrom(fd, (char *)&req, 1, 0, (struct sockaddr *)&ss, &ss_len) == 1) {
-        if (req == DISCOVERY_VER)
-            sendto(fd, buf, namelen + 1, 0, (struct sockaddr *)&ss, ss_len);
+    double wall, cpu;
+
+    get_clocks(&wall, &cpu);
+    return wall;
+}
+
+static void ingest(double at, off_t bytes)
+{
+    double age = at - ingest_started;
+
+    if (age >= INGEST_WINDOW) {
+        ingest_prev = (age < 2 * INGEST_WINDOW) ? ingest_cur : 0;
+        ingest_cur = 0;
+        ingest_started += INGEST_WINDOW * (long)(age / INGEST_WINDOW);
+    }
+    ingest_cur += bytes;
+}
+
+/* Return the rate and store the number of transfers. */
+static double get_status(unsigned int *transfersp)
+{
+    double at = now();
+    double rate;
+
+    pthread_mutex_lock(&status_lock);
+    ingest(at, 0);
+    rate = (ingest_prev * (1 - (at - ingest_started) / INGEST_WINDOW) +
+            ingest_cur) / INGEST_WINDOW;
+    *transfersp = transfers;
+    pthread_mutex_unlock(&status_lock);
+    return rate;
+}
+
+/* Make the reply of version 2 with the current status into buf. */
+static size_t status_reply(unsigned char *buf)
+{
+    struct peer_status st;
+    struct statvfs sv;
+    double rate;
+
+    memset(&st, '\0', sizeof st);
+    st.caps = (allow_forced ? DISCOVERY_CAP_FORCED : 0) |
+              (calc_digest ? DISCOVERY_CAP_DIGEST : 0) |
+              DISCOVERY_CAP_SPARSE;
+    rate = get_status(&st.transfers) / 1024;
+    st.rate_kib = (rate < UINT32_MAX) ? (uint32_t)rate : UINT32_MAX;
+    if (statvfs(".", &sv) == 0) {
+        unsigned long long mib = (unsigned long long)sv.f_bavail *
+                                 sv.f_frsize >> 20;
+        st.free_mib = (mib < UINT32_MAX) ? (uint32_t)mib : UINT32_MAX;
+    }
+    return discovery_reply(buf, myname, &st);
+}
+
+/* Replies sent to a source lately, as a token bucket. */
+struct limit {
+    unsigned char addr[16];    /* of IPv6, or of IPv4 in its first bytes */
+    double tokens;
+    double at;
+};
+
+/* Return 1 if the source of a request may be answered, 0 if it has been
+ * answered too often lately. Every source has a bucket of LIMIT_BURST
+ * replies refilled at LIMIT_RATE per second, and sources sharing a slot
+ * of limits take it over from each other. */
+static int may_reply(struct limit *limits, const struct sockaddr_storage *ss,
+                     double at)
+{
+    unsigned char addr[16];
+    struct limit *l;
+    unsigned int hash = 0;
+    size_t i;
+
+    memset(addr, '\0', sizeof addr);
+    if (ss->ss_family == AF_INET)
+        memcpy(addr, &((const struct sockaddr_in *)ss)->sin_addr, 4);
+    else if (ss->ss_family == AF_INET6)
+        memcpy(addr, &((const struct sockaddr_in6 *)ss)->sin6_addr, 16);
+    else
+        return 1;
+
+    for (i = 0; i < sizeof addr; i++)
+        hash = hash * 31 + addr[i];
+    l = &limits[hash % LIMIT_SLOTS];
+
+    if (memcmp(l->addr, addr, sizeof addr) || !l->at) {
+        memcpy(l->addr, addr, sizeof addr);
+        l->tokens = LIMIT_BURST;
+    } else {
+        l->tokens += (at - l->at) * LIMIT_RATE;
+        if (l->tokens > LIMIT_BURST)
+            l->tokens = LIMIT_BURST;
+    }
+    l->at = at;
+
+    if (l->tokens < 1)
+        return 0;
+    l->tokens--;
+    return 1;
+}
+
+/* Wait for requests, and receive up to n of them as long as they come
+ * without waiting. Return the number received. */
+static int receive_requests(int fd, struct request *reqs, int n)
+{
+#ifdef MSG_WAITFORONE
+    struct mmsghdr msgs[DISCOVERY_BATCH];
+    struct iovec iov[DISCOVERY_BATCH];
+    int i, got;
+
+    memset(msgs, '\0', sizeof msgs);
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = reqs[i].buf;
+        iov[i].iov_len = sizeof reqs[i].buf;
+        msgs[i].msg_hdr.msg_name = &reqs[i].ss;
+        msgs[i].msg_hdr.msg_namelen = sizeof reqs[i].ss;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    got = recvmmsg(fd, msgs, n, MSG_WAITFORONE, NULL);
+    for (i = 0; i < got; i++) {
+        reqs[i].len = msgs[i].msg_len;
+        reqs[i].ss_len = msgs[i].msg_hdr.msg_namelen;
+    }
+    return (got > 0) ? got : 0;
+#else
+    int got;
+
+    for (got = 0; got < n; got++) {
+        ssize_t len;
+
+        reqs[got].ss_len = sizeof reqs[got].ss;
+        len = recvfrom(fd, (char *)reqs[got].buf, sizeof reqs[got].buf,
+                       got ? MSG_DONTWAIT : 0,
+                       (struct sockaddr *)&reqs[got].ss, &reqs[got].ss_len);
+        if (len < 0)
+            break;
+        reqs[got].len = len;
+    }
+    return got;
+#endif
+}
+
+/* Send the replies of the n requests, return the number sent. */
+static int send_replies(int fd, const struct request *reqs, int n)
+{
+#ifdef MSG_WAITFORONE
+    struct mmsghdr msgs[DISCOVERY_BATCH];
+    struct iovec iov[DISCOVERY_BATCH];
+    int i, sent = 0;
+
+    memset(msgs, '\0', sizeof msgs);
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = (void *)reqs[i].reply;
+        iov[i].iov_len = reqs[i].replylen;
+        msgs[i].msg_hdr.msg_name = (void *)&reqs[i].ss;
+        msgs[i].msg_hdr.msg_namelen = reqs[i].ss_len;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* Sending stops at a message failing, as for an address unreachable,
+     * which is skipped so the rest of the batch still gets replies. */
+    i = 0;
+    while (i < n) {
+        int rv = sendmmsg(fd, msgs + i, n - i, 0);
+
+        if (rv > 0) {
+            i += rv;
+            sent += rv;
+        } else if (rv < 0 && errno == EINTR) {
+            continue;
+        } else {
+            i++;
+        }
+    }
+    return sent;
+#else
+    int i, sent = 0;
+
+    for (i = 0; i < n; i++)
+        if (sendto(fd, (const char *)reqs[i].reply, reqs[i].replylen, 0,
+                   (const struct sockaddr *)&reqs[i].ss, reqs[i].ss_len) >= 0)
+            sent++;
+    return sent;
+#endif
+}
+
+/* Requests are drained in batches and answered at once with replies built
+ * beforehand, so a storm of them costs few system calls. There is a thread
+ * for the socket of each family. */
+static void *answer_discovery(void *arg)
+{
+    int fd = *(int *)arg;
+    struct limit *limits = calloc(LIMIT_SLOTS, sizeof *limits);
+    struct request reqs[DISCOVERY_BATCH];
+    unsigned char reply1[DISCOVERY_REPLY_MAX];
+    unsigned char reply2[DISCOVERY_REPLY_MAX];
+    size_t len1 = discovery_reply(reply1, myname, NULL);
+    size_t len2 = 0;
+    double built = 0;  /* when reply2 was */
+
+    if (!limits)
+        die("Cannot allocate limits of discovery");
+
+    for (;;) {
+        int got = receive_requests(fd, reqs, DISCOVERY_BATCH);
+        double at = now();
+        int i, n = 0;
+
+        for (i = 0; i < got; i++) {
+            int version = discovery_accepts(reqs[i].buf, reqs[i].len);
+
+            if (!version || !may_reply(limits, &reqs[i].ss, at))
+                continue;
+            if (version == DISCOVERY_VER_MIN) {
+                reqs[i].reply = reply1;
+                reqs[i].replylen = len1;
+            } else {
+                if (!len2 || at - built >= STATUS_SECS) {
+                    len2 = status_reply(reply2);
+                    built = at;
+                }
+                reqs[i].reply = reply2;
+                reqs[i].replylen = len2;
+            }
+            if (n != i)
+                reqs[n] = reqs[i];
+            n++;
+        }
+
+        for (i = send_replies(fd, reqs, n); i > 0; i--)
+            metrics_discovery();
+    }
+    return NULL;
+}
+
+static void start_discovery(int *fdp)
+{
+    sigset_t all, old;
+    pthread_t thread;
+    int rv;
+
+    /* Signals must interrupt system calls of the main thread. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    rv = pthread_create(&thread, NULL, answer_discovery, fdp);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rv != 0)
+        die("Cannot start discovery thread");
+    pthread_detach(thread);
+}
+
+static void first_request(void)
+{
+    if (accepted_at) {
+        metrics_handshake(now() - accepted_at);
+        accepted_at = 0;
+    }
+}
+
+static void print_stats(const struct xfer_stats *stats)
+{
+    char line[STATS_LINE_MAX];
+    int i;
+
+    for (i = 0; stats_format(stats, i, line, sizeof line) == 0; i++)
+        info("%s", line);
+}
+
+static void on_progress(const struct catch_context *ctx, int stage)
+{
+    if (stage == CATCH_RECEIVE) {
+        double at = now();
+
+        pthread_mutex_lock(&status_lock);
+        ingest(at, ctx->filepos - received_pos);
+        pthread_mutex_unlock(&status_lock);
+        metrics_received(ctx->filepos - received_pos);
+        received_pos = ctx->filepos;
     }
 }
 
 static void on_stage_change(const struct catch_context *ctx, int stage)
 {
+    events_stage(ctx, stage);
+
     switch (stage) {
     case CATCH_NEXT_FILE:
+        first_request();
         if (ctx->forced) {
             info("Forced push request of file %s (%llu bytes)", ctx->filename,
                  (unsigned long long)ctx->filelen);
@@ -49,11 +373,17 @@ static void on_stage_change(const struct catch_context *ctx, int stage)
         }
         break;
     case CATCH_RECEIVE:
-        if (!ctx->fileoff) {
+        receive_started = now();
+        received_pos = ctx->filepos;
+        if (ctx->srcfd >= 0) {
+            info("Copying file %s (%llu bytes) passed by peer...",
+                 ctx->filename,
+                 (unsigned long long)(ctx->filelen - ctx->filepos));
+        } else if (!ctx->fileoff) {
             info("Receiving file %s (%llu bytes)...",
                  ctx->filename, (unsigned long long)ctx->filelen);
         } else {
-            info("Receiving continuation of file %s (%lu bytes)...",
+            info("Receiving continuation of file %s (%llu bytes)...",
                  ctx->filename,
                  (unsigned long long)(ctx->filelen - ctx->fileoff));
         }
@@ -64,24 +394,75 @@ static void on_stage_change(const struct catch_context *ctx, int stage)
     }
 }
 
-static int handle_connection(int sockfd)
+static int handle_connection(int sockfd, int is_unix)
 {
     int rv = 0;
     int close_connection = 0;
     char filename[4096];
+    struct transport tr;
+    struct sink sink;
     struct catch_context ctx;
+    struct xfer_stats stats;
+    double started;
+    size_t chunksize = tune_socket(sockfd, SO_RCVBUF, bufsize, rate);
+    unsigned char *chunkbuf = malloc(chunksize);
+
+    if (!chunkbuf) {
+        err("Cannot allocate %lu bytes", (unsigned long)chunksize);
+        return RV_IOERROR;
+    }
+
+    if (is_unix)
+        unix_transport_init(&tr, sockfd);
+    else
+        sock_transport_init(&tr, sockfd);
+    fd_sink_init(&sink, AT_FDCWD);
 
     memset(&ctx, '\0', sizeof ctx);
     ctx.terminate = &terminate;
     ctx.on_stage_change = on_stage_change;
-    ctx.sk = sockfd;
+    ctx.on_progress = on_progress;
+    ctx.tr = &tr;
+    ctx.sink = &sink;
     ctx.filename = filename;
     ctx.filenamesz = sizeof filename;
-    ctx.calc_digest = 1;
+    ctx.calc_digest = calc_digest;
     ctx.allow_forced = allow_forced;
+    ctx.chunksize = chunksize;
+    ctx.chunkbuf = chunkbuf;
+    if (show_stats)
+        ctx.stats = &stats;
 
     while (!close_connection) {
+        /* A request told the offset to push from is retried by the peer,
+         * and both make a single request in stats, metrics and events. */
+        if (rv != RV_OFFSET) {
+            if (show_stats)
+                stats_reset(&stats);
+            started = now();
+        }
+        filename[0] = '\0';
+        receive_started = 0;
         rv = libcatch_handle_request(&ctx);
+        if (show_stats && (rv == 0 || rv == RV_COMPLETED_DIGEST_MISMATCH))
+            print_stats(&stats);
+
+        /* Account for content received since the last progress report. */
+        if (receive_started)
+            on_progress(&ctx, CATCH_RECEIVE);
+
+        /* A connection closed between requests has not made one. */
+        if (filename[0])
+            first_request();
+        if (filename[0] && rv != RV_OFFSET) {
+            double end = now();
+            double receive_secs = receive_started ? end - receive_started : 0;
+
+            metrics_request(rv, ctx.fileoff > 0);
+            if (rv == 0 && receive_secs > 0)
+                metrics_throughput((ctx.filelen - ctx.fileoff) / receive_secs);
+            events_done(&ctx, rv, end - started, receive_secs);
+        }
 
         switch (rv) {
         case 0:
@@ -137,12 +518,140 @@ static int handle_connection(int sockfd)
         }
     }
 
+    if (is_unix)
+        unix_transport_free(&tr);
+    free(chunkbuf);
     return rv;
 }
 
+static void accept_connection(int listenfd, int is_unix)
+{
+    int connfd = accept(listenfd, NULL, NULL);
+
+    if (connfd >= 0) {
+        int rv;
+
+        /* Replies are sent at once, so Nagle's algorithm would only
+         * delay them. */
+        if (!is_unix) {
+            int optval = 1;
+            (void)setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY,
+                             &optval, sizeof optval);
+        }
+
+        accepted_at = now();
+        metrics_connection(1);
+        pthread_mutex_lock(&status_lock);
+        transfers++;
+        pthread_mutex_unlock(&status_lock);
+        rv = handle_connection(connfd, is_unix);
+        pthread_mutex_lock(&status_lock);
+        transfers--;
+        pthread_mutex_unlock(&status_lock);
+        metrics_connection(-1);
+
+        /* If something wrong happened and we have to actively close
+         * the connection, let us reset it. Otherwise, it will end
+         * up in the TIME-WAIT state, which will make consequent run
+         * of catch impossible until the timeout exceeds. */
+        if (rv != RV_CONNCLOSED && !is_unix) {
+            struct linger linger = { 1, 0 };
+            (void)setsockopt(connfd, SOL_SOCKET, SO_LINGER,
+                             &linger, sizeof linger);
+        }
+        close(connfd);
+    } else {
+        err_errno("Cannot accept connection");
+    }
+}
+
+/* Listen on both IPv6 and IPv4 with a single socket, or on IPv4 only if the
+ * host has no IPv6 or the socket cannot take IPv4 as well. */
+static int listen_tcp(void)
+{
+    struct sockaddr_in6 sa6;
+    struct sockaddr_in sa;
+    int optval = 0;
+    int fd = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+
+    if (fd >= 0) {
+        memset(&sa6, '\0', sizeof sa6);
+        sa6.sin6_family = AF_INET6;
+        sa6.sin6_port = htons(CATCH_PORT);
+        sa6.sin6_addr = in6addr_any;
+
+        if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval,
+                       sizeof optval) != 0 ||
+            bind(fd, (struct sockaddr *)&sa6, sizeof sa6) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd < 0) {
+        fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (fd < 0)
+            die_errno("Cannot create TCP socket");
+
+        memset(&sa, '\0', sizeof sa);
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(CATCH_PORT);
+        sa.sin_addr.s_addr = INADDR_ANY;
+
+        if (bind(fd, (struct sockaddr *)&sa, sizeof sa) != 0)
+            die_errno("Cannot bind to TCP port %hu", CATCH_PORT);
+    }
+
+    if (listen(fd, 1) != 0)
+        die_errno("Cannot listen to TCP socket");
+    return fd;
+}
+
+/* Socket for discovery over IPv6, the group joined on every interface
+ * having multicast, or -1 if the host has no IPv6. */
+static int discovery6_socket(void)
+{
+    struct sockaddr_in6 sa6;
+    struct ipv6_mreq mreq;
+    unsigned int indexes[256];
+    int optval = 1;
+    int i, n;
+    int fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (fd < 0)
+        return -1;
+
+    memset(&sa6, '\0', sizeof sa6);
+    sa6.sin6_family = AF_INET6;
+    sa6.sin6_port = htons(CATCH_PORT);
+    sa6.sin6_addr = in6addr_any;
+
+    if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval,
+                   sizeof optval) != 0 ||
+        bind(fd, (struct sockaddr *)&sa6, sizeof sa6) != 0) {
+        err_errno("Cannot bind to UDP port %hu of IPv6, discovery over it "
+                  "is off", CATCH_PORT);
+        close(fd);
+        return -1;
+    }
+
+    inet_pton(AF_INET6, DISCOVERY_GROUP6, &mreq.ipv6mr_multiaddr);
+    n = ifaces_multicast6(indexes, sizeof indexes / sizeof indexes[0]);
+    for (i = 0; i < n; i++) {
+        mreq.ipv6mr_interface = indexes[i];
+        if (setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq,
+                       sizeof mreq) != 0)
+            err_errno("Cannot join %s on interface %u", DISCOVERY_GROUP6,
+                      indexes[i]);
+    }
+    return fd;
+}
+
 int main(int argc, const char *argv[])
 {
-    int tcpfd, udpfd;
+    int tcpfd, udpfd, udp6fd, unixfd = -1;
+    const char *unixpath = NULL;
+    const char *metricsaddr = NULL;
     struct sockaddr_in sa;
 
     /* We count on interruptable syscalls, so we avoid using signal() here. */
@@ -151,12 +660,67 @@ int main(int argc, const char *argv[])
     sigaction(SIGINT, &sigact, NULL);
     sigaction(SIGTERM, &sigact, NULL);
 
-    if (argc > 1 && !strcmp(argv[1], "-f")) {
-        allow_forced = 1;
+    for (;;) {
+        if (argc > 1 && !strcmp(argv[1], "-f")) {
+            allow_forced = 1;
+        } else if (argc > 1 && !strcmp(argv[1], "--stats")) {
+            show_stats = 1;
+        } else if (argc > 1 && !strcmp(argv[1], "--no-digest")) {
+            calc_digest = 0;
+        } else if (argc > 2 && !strcmp(argv[1], "-e")) {
+            events_open(argv[2]);
+            argc--;
+            argv++;
+        } else if (argc > 2 && !strcmp(argv[1], "-m")) {
+            metricsaddr = argv[2];
+            argc--;
+            argv++;
+        } else if (argc > 2 && !strcmp(argv[1], "-u")) {
+            unixpath = argv[2];
+            argc--;
+            argv++;
+        } else if (argc > 2 && !strcmp(argv[1], "-b")) {
+            bufsize = parse_size(argv[2]);
+            argc--;
+            argv++;
+        } else if (argc > 2 && !strcmp(argv[1], "-r")) {
+            rate = parse_size(argv[2]);
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
         argc--;
         argv++;
     }
 
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+        puts("usage: catch [-f] [-b bufsize] [-r mbits] [-u path] [-m addr]\n"
+             "             [-e dest] [--stats] [--no-digest] [peername]\n");
+        puts("Files pushed are caught into the current directory. Catch");
+        puts("answers discovery of peername, or of the hostname if it is");
+        puts("not given.\n");
+        puts("Option -f accepts forced pushes, which overwrite files.\n");
+        puts("Socket receive buffer is sized for a link of 1000 Mbit/s (or");
+        puts("mbits given by -r) with the measured round-trip time, unless");
+        puts("its size is given by -b.\n");
+        puts("Option -u listens on UNIX domain socket path too, where push");
+        puts("unix:path passes its files to be copied directly.\n");
+        puts("Option -m serves metrics for Prometheus over HTTP at addr,");
+        puts("which is [host:]port (host is 127.0.0.1 unless given) or");
+        puts("unix:path.\n");
+        puts("Option -e writes events of transfers as lines of JSON to dest,");
+        puts("which is an open file descriptor number or unix:path of a");
+        puts("listening UNIX domain socket.\n");
+        puts("Option --stats shows time spent receiving, hashing and writing");
+        puts("of each file completed.\n");
+        puts("Option --no-digest leaves transfers unverified, so push must");
+        puts("be run with it too.\n");
+        puts("BEWARE! This program catches files carelessly and absolutely");
+        puts("unencrypted. DO NOT USE IT IF YOU CAN.");
+        exit(EXIT_FAILURE);
+    }
+
     if (argc == 2) {
         size_t namelen = strlen(argv[1]);
         if (namelen > PEERNAME_MAX)
@@ -168,20 +732,13 @@ int main(int argc, const char *argv[])
         myname[sizeof myname - 1] = '\0';
     }
 
-    tcpfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (tcpfd < 0)
-        die_errno("Cannot create TCP socket");
+    tcpfd = listen_tcp();
 
+    memset(&sa, '\0', sizeof sa);
     sa.sin_family = AF_INET;
     sa.sin_port = htons(CATCH_PORT);
     sa.sin_addr.s_addr = INADDR_ANY;
 
-    if (bind(tcpfd, (struct sockaddr *)&sa, sizeof sa) != 0)
-        die_errno("Cannot bind to TCP port %hu", CATCH_PORT);
-
-    if (listen(tcpfd, 1) != 0)
-        die_errno("Cannot listen to TCP socket");
-
     udpfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (udpfd < 0)
         die_errno("Cannot create UDP socket");
@@ -189,46 +746,60 @@ int main(int argc, const char *argv[])
     if (bind(udpfd, (struct sockaddr *)&sa, sizeof sa) != 0)
         die_errno("Cannot bind to UDP port %hu", CATCH_PORT);
 
+    udp6fd = discovery6_socket();
+
+    /* Pushes from the same host may pass their files instead of sending
+     * the content. */
+    if (unixpath) {
+        unixfd = unix_listen(unixpath, 1);
+        if (unixfd < 0)
+            die_errno("Cannot listen to %s", unixpath);
+    }
+
+    if (metricsaddr)
+        metrics_start(metricsaddr);
+
+    start_discovery(&udpfd);
+    if (udp6fd >= 0)
+        start_discovery(&udp6fd);
+
     info("Initialized with peername %s", myname);
+    events_ready(myname);
 
     while (!terminate) {
         fd_set rfds;
         int retval;
+        int maxfd = tcpfd;
 
         FD_ZERO(&rfds);
         FD_SET(tcpfd, &rfds);
-        FD_SET(udpfd, &rfds);
+        if (unixfd >= 0) {
+            FD_SET(unixfd, &rfds);
+            if (unixfd > maxfd)
+                maxfd = unixfd;
+        }
 
-        retval = select(udpfd + 1, &rfds, NULL, NULL, NULL);
+        retval = select(maxfd + 1, &rfds, NULL, NULL, NULL);
 
         if (retval == -1 && errno != EINTR)
             die_errno("select()");
         else if (retval > 0) {
-            if (FD_ISSET(udpfd, &rfds)) {
-                handle_discovery(udpfd);
-            } else {
-                socklen_t sa_len = sizeof sa;
-                int connfd = accept(tcpfd, (struct sockaddr *)&sa, &sa_len);
-                if (connfd >= 0) {
-                    int rv = handle_connection(connfd);
-
-                    /* If something wrong happened and we have to actively close
-                     * the connection, let us reset it. Otherwise, it will end
-                     * up in the TIME-WAIT state, which will make consequent run
-                     * of catch impossible until the timeout exceeds. */
-                    if (rv != RV_CONNCLOSED) {
-                        struct linger linger = { 1, 0 };
-                        (void)setsockopt(connfd, SOL_SOCKET, SO_LINGER,
-                                         &linger, sizeof linger);
-                    }
-                    close(connfd);
-                } else {
-                    err_errno("Cannot accept TCP connection");
-                }
-            }
+            if (FD_ISSET(tcpfd, &rfds))
+                accept_connection(tcpfd, 0);
+            else
+                accept_connection(unixfd, 1);
         }
     }
+    if (unixfd >= 0) {
+        close(unixfd);
+        unlink(unixpath);
+    }
+    metrics_stop();
+    if (show_stats)
+        print_rusage();
     close(udpfd);
+    if (udp6fd >= 0)
+        close(udp6fd);
     close(tcpfd);
 
     return EXIT_SUCCESS;
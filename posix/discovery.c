@@ -0,0 +1,90 @@
+#include <string.h>
+
+#include "discovery.h"
+
+static void put_be16(unsigned char *p, unsigned int v)
+{
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    put_be16(p, v >> 16);
+    put_be16(p + 2, v & 0xffff);
+}
+
+static unsigned int get_be16(const unsigned char *p)
+{
+    return (unsigned int)p[0] << 8 | p[1];
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return (uint32_t)get_be16(p) << 16 | get_be16(p + 2);
+}
+
+size_t discovery_request(unsigned char *buf)
+{
+    buf[0] = DISCOVERY_VER_MIN;
+    buf[1] = DISCOVERY_VER;
+    return DISCOVERY_REQ_LEN;
+}
+
+int discovery_accepts(const unsigned char *buf, size_t len)
+{
+    if (len < 1 || buf[0] != DISCOVERY_VER_MIN)
+        return 0;
+    if (len < 2 || buf[1] <= DISCOVERY_VER_MIN)
+        return DISCOVERY_VER_MIN;
+    return (buf[1] < DISCOVERY_VER) ? buf[1] : DISCOVERY_VER;
+}
+
+size_t discovery_reply(unsigned char *buf, const char *peername,
+                       const struct peer_status *st)
+{
+    size_t namelen = strlen(peername);
+    unsigned char *p;
+
+    if (namelen > PEERNAME_MAX)
+        namelen = PEERNAME_MAX;
+    buf[0] = (unsigned char)namelen;
+    memcpy(&buf[1], peername, namelen);
+    if (!st)
+        return namelen + 1;
+
+    p = &buf[namelen + 1];
+    p[0] = DISCOVERY_VER;
+    p[1] = (unsigned char)st->caps;
+    put_be16(p + 2, (st->transfers < 0xffff) ? st->transfers : 0xffff);
+    put_be32(p + 4, st->free_mib);
+    put_be32(p + 8, st->rate_kib);
+    return namelen + 1 + DISCOVERY_STATUS_LEN;
+}
+
+int discovery_parse(const unsigned char *buf, size_t len, char *name,
+                    struct peer_status *st)
+{
+    size_t namelen;
+    const unsigned char *p;
+
+    if (len < 1 || len < 1 + (size_t)buf[0])
+        return -1;
+    namelen = buf[0];
+    memcpy(name, &buf[1], namelen);
+    name[namelen] = '\0';
+
+    memset(st, '\0', sizeof *st);
+    st->version = DISCOVERY_VER_MIN;
+
+    /* Status of later versions begins with that of version 2. */
+    p = &buf[namelen + 1];
+    if (len >= namelen + 1 + DISCOVERY_STATUS_LEN && p[0] >= 2) {
+        st->version = p[0];
+        st->caps = p[1];
+        st->transfers = get_be16(p + 2);
+        st->free_mib = get_be32(p + 4);
+        st->rate_kib = get_be32(p + 8);
+    }
+    return 0;
+}
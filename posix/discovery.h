@@ -0,0 +1,53 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Discovery of version 2. A request is the byte DISCOVERY_VER_MIN, which
+ * catches of any version answer, followed by DISCOVERY_VER, the highest
+ * version push understands. A reply is the length of the peername and the
+ * name, followed in version 2 by the status of the catch, so push can pick
+ * the least loaded one of several catches sharing the name. */
+
+/* Requests are broadcast over IPv4 and sent to this link-local group of
+ * every interface over IPv6. */
+#define DISCOVERY_GROUP6 "ff02::2121"
+
+#define DISCOVERY_REQ_LEN 2
+#define DISCOVERY_STATUS_LEN 12
+#define DISCOVERY_REPLY_MAX (1 + PEERNAME_MAX + DISCOVERY_STATUS_LEN)
+
+#define DISCOVERY_CAP_FORCED 0x01  /* catch accepts forced pushes */
+#define DISCOVERY_CAP_DIGEST 0x02  /* catch verifies digests */
+#define DISCOVERY_CAP_SPARSE 0x04  /* catch accepts sparse pushes */
+
+struct peer_status {
+    int version;               /* of the reply, the rest is 0 if it is 1 */
+    unsigned int caps;         /* DISCOVERY_CAP_* */
+    unsigned int transfers;    /* connections being served */
+    uint32_t free_mib;         /* disk space left in the catch directory */
+    uint32_t rate_kib;         /* content received recently per second */
+};
+
+/* Make the request into buf and return its length. Its first byte alone is
+ * the request of version 1, which catches reading a single byte need. */
+size_t discovery_request(unsigned char *buf);
+
+/* Return the highest version of reply the request of len bytes accepts,
+ * or 0 if it is not a discovery request. */
+int discovery_accepts(const unsigned char *buf, size_t len);
+
+/* Make the reply of peername into buf of DISCOVERY_REPLY_MAX bytes and
+ * return its length. The status is left out if st is NULL. */
+size_t discovery_reply(unsigned char *buf, const char *peername,
+                       const struct peer_status *st);
+
+/* Parse the reply of len bytes into name of PEERNAME_MAX + 1 bytes and st,
+ * return 0 on success or -1 if it is malformed. */
+int discovery_parse(const unsigned char *buf, size_t len, char *name,
+                    struct peer_status *st);
+
+#endif
@@ -0,0 +1,167 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "events.h"
+#include "unixsock.h"
+
+/* Big enough for any event, even with the longest file name escaped. */
+#define EVENTS_BUFSIZE 32768
+#define EVENT_MAX 26624
+
+static int events_fd = -1;
+static char buf[EVENTS_BUFSIZE];
+static size_t buflen;
+
+static const char *const stage_names[] = {
+    "next_file", "receive", "sha1_calc"
+};
+
+void events_open(const char *dest)
+{
+    size_t prefixlen = strlen(UNIX_PEER_PREFIX);
+    struct sigaction sigact;
+
+    if (!strncmp(dest, UNIX_PEER_PREFIX, prefixlen)) {
+        events_fd = unix_connect(dest + prefixlen);
+        if (events_fd < 0)
+            die_errno("Cannot connect to %s", dest + prefixlen);
+    } else {
+        char *end;
+        long fd = strtol(dest, &end, 10);
+
+        if (*dest == '\0' || *end != '\0' || fd < 0 || fd > 65535)
+            die("Invalid events destination %s", dest);
+        events_fd = fd;
+    }
+
+    /* A reader going away must not kill catch. */
+    memset(&sigact, '\0', sizeof sigact);
+    sigact.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sigact, NULL);
+}
+
+void events_flush(void)
+{
+    size_t pos = 0;
+
+    while (pos < buflen) {
+        ssize_t n = write(events_fd, buf + pos, buflen - pos);
+        if (n > 0) {
+            pos += n;
+        } else if (n < 0 && errno == EINTR && !terminate) {
+            continue;
+        } else {
+            err_errno("Cannot write events, no more will be written");
+            events_fd = -1;
+            break;
+        }
+    }
+    buflen = 0;
+}
+
+/* Append to the event being formatted at the end of the buffer. */
+static void add(size_t *len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf + buflen + *len, EVENT_MAX - *len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        *len += ((size_t)n < EVENT_MAX - *len) ? (size_t)n
+                                                : EVENT_MAX - *len - 1;
+}
+
+static void add_string(size_t *len, const char *str)
+{
+    add(len, "\"");
+    for (; *str; str++) {
+        unsigned char c = *str;
+
+        if (c == '"' || c == '\\')
+            add(len, "\\%c", c);
+        else if (c < 0x20)
+            add(len, "\\u%04x", c);
+        else
+            add(len, "%c", c);
+    }
+    add(len, "\"");
+}
+
+/* Start an event, making room for it first. */
+static int begin(size_t *len, const char *event)
+{
+    if (events_fd < 0)
+        return 0;
+    if (buflen + EVENT_MAX > sizeof buf)
+        events_flush();
+
+    *len = 0;
+    add(len, "{\"event\":\"%s\"", event);
+    return 1;
+}
+
+static void end(size_t len)
+{
+    buf[buflen + len] = '\n';
+    buflen += len + 1;
+}
+
+static void add_request(size_t *len, const struct catch_context *ctx)
+{
+    add(len, ",\"file\":");
+    add_string(len, ctx->filename);
+    add(len, ",\"size\":%llu,\"offset\":%llu,\"forced\":%s",
+        (unsigned long long)ctx->filelen, (unsigned long long)ctx->fileoff,
+        ctx->forced ? "true" : "false");
+}
+
+void events_ready(const char *peername)
+{
+    size_t len;
+
+    if (begin(&len, "ready")) {
+        add(&len, ",\"peername\":");
+        add_string(&len, peername);
+        add(&len, "}");
+        end(len);
+        events_flush();
+    }
+}
+
+void events_stage(const struct catch_context *ctx, int stage)
+{
+    size_t len;
+
+    if (begin(&len, stage_names[stage])) {
+        add_request(&len, ctx);
+        add(&len, "}");
+        end(len);
+    }
+}
+
+void events_done(const struct catch_context *ctx, int rv, double secs,
+                 double receive_secs)
+{
+    off_t received = ctx->filepos - ctx->fileoff;
+    size_t len;
+
+    if (begin(&len, "done")) {
+        add_request(&len, ctx);
+        add(&len, ",\"position\":%llu,\"rv\":%d,\"result\":\"%s\","
+            "\"duration\":%.6f,\"throughput\":%.0f}",
+            (unsigned long long)ctx->filepos, rv, rv_name(rv), secs,
+            (receive_secs > 0 && received > 0) ? received / receive_secs : 0);
+        end(len);
+        events_flush();
+    }
+}
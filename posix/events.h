@@ -0,0 +1,28 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "libcatch.h"
+
+/* Events of catch as JSON objects, one per line, for programs watching it.
+ * They are buffered and written out once a request is done, so a slow
+ * reader does not hold up transfers in between. */
+
+/* Write events to "unix:PATH", a listening UNIX domain socket, or to open
+ * file descriptor given by its number. Dies on failure. */
+void events_open(const char *dest);
+
+/* Catch is ready to accept connections. */
+void events_ready(const char *peername);
+
+/* The request has got to stage of enum catch_stage. */
+void events_stage(const struct catch_context *ctx, int stage);
+
+/* The request has ended with rv after the seconds, and the content
+ * transferred has been received in receive_secs. */
+void events_done(const struct catch_context *ctx, int rv, double secs,
+                 double receive_secs);
+
+/* Write out events buffered so far. */
+void events_flush(void);
+
+#endif
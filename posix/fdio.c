@@ -0,0 +1,429 @@
+#define _GNU_SOURCE /* copy_file_range(), fallocate(), SEEK_DATA */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "fdio.h"
+
+#define MMAP_ALLOC_STEP (8 << 20) /* space allocated ahead by mapped sink */
+
+static int fd_size(struct source *src, off_t *size)
+{
+    *size = src->len;
+    return 0;
+}
+
+static int fd_stat(int fd, off_t *size)
+{
+    struct stat sb;
+
+    if (fstat(fd, &sb) != 0)
+        return RV_IOERROR;
+    if (!S_ISREG(sb.st_mode))
+        return RV_NOT_REGULAR_FILE;
+
+    *size = sb.st_size;
+    return 0;
+}
+
+static int pread_entire(int fd, off_t off, void *buf, size_t len)
+{
+    char *ptr = buf;
+
+    while (len > 0) {
+        ssize_t n = pread(fd, ptr, len, off);
+        if (n > 0) {
+            ptr += n;
+            off += n;
+            len -= n;
+        } else if (n == 0 || errno != EINTR) {
+            return RV_IOERROR;
+        }
+    }
+    return 0;
+}
+
+static int fd_read_at(struct source *src, off_t off, void *buf, size_t len)
+{
+    return pread_entire(src->fd, off, buf, len);
+}
+
+/* File systems not knowing about holes report the whole file as data. */
+static int fd_find_data(struct source *src, off_t off, off_t *start,
+                        off_t *end)
+{
+#ifdef SEEK_DATA
+    off_t pos = lseek(src->fd, off, SEEK_DATA);
+
+    if (pos >= 0) {
+        *start = pos;
+        *end = lseek(src->fd, pos, SEEK_HOLE);
+        return (*end >= 0) ? 0 : RV_IOERROR;
+    } else if (errno == ENXIO) {
+        *start = *end = src->len;
+        return 0;
+    }
+#endif
+
+    *start = off;
+    *end = src->len;
+    return 0;
+}
+
+int fd_source_init(struct source *src, int fd)
+{
+    memset(src, '\0', sizeof *src);
+    src->read_at = fd_read_at;
+    src->size = fd_size;
+    src->find_data = fd_find_data;
+    src->fd = fd;
+    return fd_stat(fd, &src->len);
+}
+
+static int mmap_read_at(struct source *src, off_t off, void *buf, size_t len)
+{
+    if (off > src->len || (off_t)len > src->len - off)
+        return RV_IOERROR;
+
+    memcpy(buf, src->data + off, len);
+    return 0;
+}
+
+static const void *mmap_map(struct source *src, off_t off, size_t len)
+{
+    if (off > src->len || (off_t)len > src->len - off)
+        return NULL;
+
+    return src->data + off;
+}
+
+static void mmap_close(struct source *src)
+{
+    if (src->data)
+        munmap((void *)src->data, src->len);
+    src->data = NULL;
+}
+
+int mmap_source_init(struct source *src, int fd)
+{
+    void *data = NULL;
+    int rv = fd_source_init(src, fd);
+
+    if (rv)
+        return rv;
+
+    /* Empty files cannot be mapped, but there is nothing to map anyway. */
+    if (src->len > 0) {
+        if ((off_t)(size_t)src->len != src->len)
+            return RV_IOERROR;
+
+        data = mmap(NULL, src->len, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            return RV_IOERROR;
+
+        (void)madvise(data, src->len, MADV_SEQUENTIAL);
+    }
+
+    src->read_at = mmap_read_at;
+    src->map = mmap_map;
+    src->close = mmap_close;
+    src->data = data;
+    return 0;
+}
+
+static int fd_sink_stat(struct sink *sink, const char *name, off_t *len)
+{
+    struct stat sb;
+
+    if (fstatat(sink->dirfd, name, &sb, 0) != 0)
+        return (errno == ENOENT) ? RV_NOENT : RV_IOERROR;
+    if (!S_ISREG(sb.st_mode))
+        return RV_NOT_REGULAR_FILE;
+
+    *len = sb.st_size;
+    return 0;
+}
+
+static int fd_sink_open(struct sink *sink, const char *name, int create,
+                        off_t len)
+{
+    int flags = O_RDWR | O_CREAT | (create ? O_TRUNC : 0);
+    UNUSED(len);
+
+    sink->fd = openat(sink->dirfd, name, flags, 0666);
+    return (sink->fd >= 0) ? 0 : RV_IOERROR;
+}
+
+static int pwrite_entire(int fd, off_t off, const void *buf, size_t len)
+{
+    const char *ptr = buf;
+
+    while (len > 0) {
+        ssize_t n = pwrite(fd, ptr, len, off);
+        if (n > 0) {
+            ptr += n;
+            off += n;
+            len -= n;
+        } else if (n == 0 || errno != EINTR) {
+            return RV_IOERROR;
+        }
+    }
+    return 0;
+}
+
+static int fd_sink_write_at(struct sink *sink, off_t off, const void *buf,
+                            size_t len)
+{
+    return pwrite_entire(sink->fd, off, buf, len);
+}
+
+static int fd_sink_read_at(struct sink *sink, off_t off, void *buf, size_t len)
+{
+    return pread_entire(sink->fd, off, buf, len);
+}
+
+/* Copy within the kernel if possible, which may even share the blocks
+ * between the files. Otherwise, copy through a buffer. */
+static int fd_sink_copy_from(struct sink *sink, off_t off, int fd, size_t len)
+{
+    char buf[8192];
+
+#ifdef __linux__
+    off_t inoff = off, outoff = off;
+
+    while (len > 0) {
+        ssize_t n = copy_file_range(fd, &inoff, sink->fd, &outoff, len, 0);
+        if (n > 0)
+            len -= n;
+        else if (n == 0)
+            return RV_IOERROR; /* the file is shorter than announced */
+        else if (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                 errno == EOPNOTSUPP)
+            break;
+        else if (errno != EINTR)
+            return RV_IOERROR;
+    }
+    off = outoff;
+#endif
+
+    while (len > 0) {
+        size_t chunk = (len > sizeof buf) ? sizeof buf : len;
+
+        if (pread_entire(fd, off, buf, chunk) != 0 ||
+            pwrite_entire(sink->fd, off, buf, chunk) != 0)
+            return RV_IOERROR;
+        off += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* Write zeros where the blocks cannot be deallocated. */
+static int punch_hole(int fd, off_t off, off_t len)
+{
+    char buf[8192];
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  off, len) == 0)
+        return 0;
+#endif
+
+    memset(buf, '\0', sizeof buf);
+    while (len > 0) {
+        size_t chunk = (len > (off_t)sizeof buf) ? sizeof buf : (size_t)len;
+
+        if (pwrite_entire(fd, off, buf, chunk) != 0)
+            return RV_IOERROR;
+        off += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* Holes beyond the end of file are made by extending it. */
+static int fd_sink_zero(struct sink *sink, off_t off, off_t len)
+{
+    off_t size;
+
+    if (fd_stat(sink->fd, &size) != 0)
+        return RV_IOERROR;
+    if (off + len > size && ftruncate(sink->fd, off + len) != 0)
+        return RV_IOERROR;
+    if (off < size)
+        return punch_hole(sink->fd, off,
+                          (size - off < len) ? size - off : len);
+    return 0;
+}
+
+static int fd_sink_finalize(struct sink *sink, int rv)
+{
+    UNUSED(rv);
+    rv = close(sink->fd);
+    sink->fd = -1;
+    return (rv == 0) ? 0 : RV_IOERROR;
+}
+
+void fd_sink_init(struct sink *sink, int dirfd)
+{
+    memset(sink, '\0', sizeof *sink);
+    sink->stat = fd_sink_stat;
+    sink->open = fd_sink_open;
+    sink->write_at = fd_sink_write_at;
+    sink->read_at = fd_sink_read_at;
+    sink->finalize = fd_sink_finalize;
+    sink->copy_from = fd_sink_copy_from;
+    sink->zero = fd_sink_zero;
+    sink->fd = -1;
+    sink->dirfd = dirfd;
+}
+
+/* Mapped sink keeps size of the file in sink->cap, the end of data
+ * actually present in it in sink->len and the end of space allocated for
+ * it in sink->alloc. The file is extended to its size at once, but space
+ * is only allocated as content arrives. */
+static int mmap_sink_open(struct sink *sink, const char *name, int create,
+                          off_t len)
+{
+    off_t curlen;
+    int rv;
+
+    sink->data = NULL;
+    if ((off_t)(size_t)len != len)
+        return RV_TOOBIG;
+
+    rv = fd_sink_open(sink, name, create, len);
+    if (rv)
+        return rv;
+
+    rv = fd_stat(sink->fd, &curlen);
+    if (!rv && len > 0) {
+        if (len > curlen && ftruncate(sink->fd, len) != 0) {
+            rv = RV_IOERROR;
+        } else {
+            void *data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                              sink->fd, 0);
+            if (data == MAP_FAILED)
+                rv = RV_IOERROR;
+            else
+                sink->data = data;
+        }
+        if (rv)
+            (void)ftruncate(sink->fd, curlen);
+    }
+
+    if (rv) {
+        close(sink->fd);
+        sink->fd = -1;
+    } else {
+        sink->len = sink->alloc = curlen;
+        sink->cap = len;
+    }
+    return rv;
+}
+
+/* Allocate space for len bytes at off before they are stored through the
+ * mapping, rather than get SIGBUS on a full disk. Space is allocated ahead
+ * in steps of MMAP_ALLOC_STEP, but not for holes skipped before off. */
+static int mmap_sink_reserve(struct sink *sink, off_t off, off_t len)
+{
+    off_t end = off + len;
+
+    if (off > sink->cap || len > sink->cap - off)
+        return RV_IOERROR;
+    if (end <= sink->alloc)
+        return 0;
+
+    if (off < sink->alloc)
+        off = sink->alloc;
+    if (end - off < MMAP_ALLOC_STEP)
+        end = (sink->cap - off < MMAP_ALLOC_STEP) ? sink->cap
+                                                  : off + MMAP_ALLOC_STEP;
+    if (posix_fallocate(sink->fd, off, end - off) != 0)
+        return RV_IOERROR;
+    sink->alloc = end;
+    return 0;
+}
+
+static int mmap_sink_write_at(struct sink *sink, off_t off, const void *buf,
+                              size_t len)
+{
+    if (mmap_sink_reserve(sink, off, len) != 0)
+        return RV_IOERROR;
+
+    memcpy(sink->data + off, buf, len);
+    if (off + (off_t)len > sink->len)
+        sink->len = off + len;
+    return 0;
+}
+
+static int mmap_sink_read_at(struct sink *sink, off_t off, void *buf,
+                             size_t len)
+{
+    if (off > sink->len || (off_t)len > sink->len - off)
+        return RV_IOERROR;
+
+    memcpy(buf, sink->data + off, len);
+    return 0;
+}
+
+static int mmap_sink_copy_from(struct sink *sink, off_t off, int fd,
+                               size_t len)
+{
+    if (mmap_sink_reserve(sink, off, len) != 0)
+        return RV_IOERROR;
+
+    if (pread_entire(fd, off, sink->data + off, len) != 0)
+        return RV_IOERROR;
+    if (off + (off_t)len > sink->len)
+        sink->len = off + len;
+    return 0;
+}
+
+/* Space allocated ahead is given back, the mapping reads zeros there. */
+static int mmap_sink_zero(struct sink *sink, off_t off, off_t len)
+{
+    if (off > sink->cap || len > sink->cap - off)
+        return RV_IOERROR;
+
+    if (punch_hole(sink->fd, off, len) != 0)
+        return RV_IOERROR;
+    if (off + len > sink->len)
+        sink->len = off + len;
+    return 0;
+}
+
+static int mmap_sink_finalize(struct sink *sink, int rv)
+{
+    UNUSED(rv);
+    rv = 0;
+
+    if (sink->data && munmap(sink->data, sink->cap) != 0)
+        rv = RV_IOERROR;
+    sink->data = NULL;
+
+    /* Whatever has not been received must not look like received. */
+    if (sink->len < sink->cap && ftruncate(sink->fd, sink->len) != 0)
+        rv = RV_IOERROR;
+
+    if (close(sink->fd) != 0)
+        rv = RV_IOERROR;
+    sink->fd = -1;
+    return rv;
+}
+
+void mmap_sink_init(struct sink *sink, int dirfd)
+{
+    fd_sink_init(sink, dirfd);
+    sink->open = mmap_sink_open;
+    sink->write_at = mmap_sink_write_at;
+    sink->read_at = mmap_sink_read_at;
+    sink->finalize = mmap_sink_finalize;
+    sink->copy_from = mmap_sink_copy_from;
+    sink->zero = mmap_sink_zero;
+}
@@ -0,0 +1,25 @@
+#ifndef FDIO_H
+#define FDIO_H
+
+#include "sink.h"
+#include "source.h"
+
+/* Source reading a regular file with pread(). Holes of the file are found
+ * with lseek(), which moves its offset. */
+int fd_source_init(struct source *src, int fd);
+
+/* Source mapping a regular file into memory, so libpush does not need to
+ * copy its content. Fails with RV_IOERROR if the file cannot be mapped.
+ * The file must not be truncated while the source is in use. */
+int mmap_source_init(struct source *src, int fd);
+
+/* Sink writing files in directory dirfd (or AT_FDCWD) with pwrite(). */
+void fd_sink_init(struct sink *sink, int dirfd);
+
+/* Sink writing files in directory dirfd (or AT_FDCWD) through shared
+ * memory mapping. Space is allocated a few megabytes ahead of the content
+ * received, and the file is cut to that content on finalization if the
+ * transfer has not completed. */
+void mmap_sink_init(struct sink *sink, int dirfd);
+
+#endif
@@ -0,0 +1,178 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__FreeBSD__) || defined(BSD) || defined(__APPLE__) || defined(__linux__)
+# include <ifaddrs.h>
+# include <net/if.h>
+#else
+#error Not implemented for this platform
+#endif
+
+#ifdef __linux__
+# include <linux/netlink.h>
+# include <linux/rtnetlink.h>
+#endif
+
+#include "common.h"
+#include "ifaces.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct in_addr *table;
+static int count;
+static unsigned int *indexes;  /* of interfaces for IPv6 multicast */
+static int nindexes;
+static int valid;              /* table is up to date */
+static int watching;           /* changes are notified through nlfd */
+static int nlfd = -1;
+
+#ifdef __linux__
+/* Subscribe to changes of links and their addresses. */
+static void watch(void)
+{
+    struct sockaddr_nl sa;
+
+    nlfd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  NETLINK_ROUTE);
+    if (nlfd < 0)
+        return;
+
+    memset(&sa, '\0', sizeof sa);
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (bind(nlfd, (struct sockaddr *)&sa, sizeof sa) != 0) {
+        close(nlfd);
+        nlfd = -1;
+        return;
+    }
+    watching = 1;
+}
+
+/* Return 1 if anything has been notified since the last call. */
+static int changed(void)
+{
+    char buf[8192];
+    int any = 0;
+
+    for (;;) {
+        ssize_t n = recv(nlfd, buf, sizeof buf, MSG_DONTWAIT);
+
+        if (n > 0)
+            any = 1;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && errno == ENOBUFS)
+            any = 1;   /* notifications have been lost */
+        else
+            break;
+    }
+    return any;
+}
+#else
+/* Other platforms tell nothing, so interfaces are enumerated every time. */
+static void watch(void)
+{
+}
+
+static int changed(void)
+{
+    return 1;
+}
+#endif
+
+static void enumerate(void)
+{
+    struct ifaddrs *ifap, *ifa;
+    int n = 0;
+
+    free(table);
+    free(indexes);
+    table = NULL;
+    indexes = NULL;
+    count = nindexes = 0;
+
+    if (getifaddrs(&ifap) != 0)
+        return;
+
+    for (ifa = ifap; ifa; ifa = ifa->ifa_next)
+        n++;
+    table = malloc((n ? n : 1) * sizeof *table);
+    indexes = malloc((n ? n : 1) * sizeof *indexes);
+    if (!table || !indexes) {
+        freeifaddrs(ifap);
+        return;
+    }
+
+    for (ifa = ifap; ifa; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET6 &&
+            (ifa->ifa_flags & (IFF_UP | IFF_MULTICAST | IFF_LOOPBACK))
+                == (IFF_UP | IFF_MULTICAST)) {
+            unsigned int index = if_nametoindex(ifa->ifa_name);
+            int i;
+
+            for (i = 0; i < nindexes; i++)
+                if (indexes[i] == index)
+                    break;
+            if (index && i == nindexes)
+                indexes[nindexes++] = index;
+        }
+
+        if ((ifa->ifa_flags & IFF_BROADCAST) && ifa->ifa_broadaddr
+                && ifa->ifa_broadaddr->sa_family == AF_INET) {
+            struct in_addr addr =
+                ((struct sockaddr_in *)ifa->ifa_broadaddr)->sin_addr;
+            int i;
+
+            /* Addresses on the same subnet share the broadcast address. */
+            for (i = 0; i < count; i++)
+                if (table[i].s_addr == addr.s_addr)
+                    break;
+            if (i == count)
+                table[count++] = addr;
+        }
+    }
+    freeifaddrs(ifap);
+    valid = 1;
+}
+
+/* Bring the tables up to date, with lock held. */
+static void refresh(void)
+{
+    /* The subscription comes first, so no change goes unnoticed. */
+    if (!watching)
+        watch();
+    if (!watching || changed())
+        valid = 0;
+    if (!valid)
+        enumerate();
+}
+
+int ifaces_broadcast(struct in_addr *addrs, int max)
+{
+    int n;
+
+    pthread_mutex_lock(&lock);
+    refresh();
+    n = (count < max) ? count : max;
+    if (n > 0)
+        memcpy(addrs, table, n * sizeof *addrs);
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+int ifaces_multicast6(unsigned int *indexesp, int max)
+{
+    int n;
+
+    pthread_mutex_lock(&lock);
+    refresh();
+    n = (nindexes < max) ? nindexes : max;
+    if (n > 0)
+        memcpy(indexesp, indexes, n * sizeof *indexesp);
+    pthread_mutex_unlock(&lock);
+    return n;
+}
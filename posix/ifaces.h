@@ -0,0 +1,18 @@
+#ifndef IFACES_H
+#define IFACES_H
+
+#include <netinet/in.h>
+
+/* Broadcast addresses and interfaces of the host, enumerated once and again
+ * only when the addresses have changed, as far as the platform tells. Safe
+ * to call from any thread. */
+
+/* Store up to max distinct broadcast addresses in addrs, return the number
+ * stored. */
+int ifaces_broadcast(struct in_addr *addrs, int max);
+
+/* Store up to max indexes of interfaces up with IPv6 addresses and
+ * multicast, but not loopback, in indexes, return the number stored. */
+int ifaces_multicast6(unsigned int *indexes, int max);
+
+#endif
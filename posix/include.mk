@@ -1,5 +1,133 @@
 PREFIX ?= /usr/local/bin
+LIBDIR ?= /usr/local/lib
+INCLUDEDIR ?= /usr/local/include
+
+CFLAGS += -fPIC
+
+push-objs += discovery.o
+push-objs += fdio.o
+push-objs += ifaces.o
+push-objs += netaddr.o
+push-objs += peercache.o
+push-objs += tune.o
+push-objs += unixsock.o
+catch-objs += discovery.o
+catch-objs += events.o
+catch-objs += fdio.o
+catch-objs += ifaces.o
+catch-objs += metrics.o
+catch-objs += tune.o
+catch-objs += unixsock.o
+push-libs += -pthread
+catch-libs += -pthread
+
+# Harness running libpush and libcatch over memory, not installed.
+memloop-objs  = memloop.o
+memloop-objs += common.o
+memloop-objs += libcatch.o
+memloop-objs += libpush.o
+memloop-objs += platform.o
+memloop-objs += progress.o
+memloop-objs += sha1.o
+memloop-objs += sink.o
+memloop-objs += source.o
+memloop-objs += stats.o
+memloop-objs += transport.o
+
+# Harness running them over a non-blocking socketpair, not installed.
+nbloop-objs  = nbloop.o
+nbloop-objs += common.o
+nbloop-objs += fdio.o
+nbloop-objs += libcatch.o
+nbloop-objs += libpush.o
+nbloop-objs += platform.o
+nbloop-objs += progress.o
+nbloop-objs += sha1.o
+nbloop-objs += sink.o
+nbloop-objs += source.o
+nbloop-objs += stats.o
+nbloop-objs += transport.o
+
+# Harness running sessions of libfpp.hpp, which it compiles, on an executor.
+coloop-objs  = coloop.o
+coloop-objs += $(libfpp-objs)
+
+# Proxy impairing connections as WAN links do, not installed either.
+impair-objs  = impair.o
+impair-objs += common.o
+
+progs += coloop impair memloop nbloop
+objs += $(coloop-objs) $(impair-objs) $(memloop-objs) $(nbloop-objs)
+vpath %.c $(src_topdir)/tests
+vpath %.cpp $(src_topdir)/tests
+
+CXXFLAGS += $(DEPFLAGS) -std=c++20 -Wall -Wextra
+CXXFLAGS += -I$(src_topdir)/$(HOST) -I$(src_topdir)
+
+libfpp-version = 1.0.0
+libfpp-soname = libfpp.so.1
+libfpp = libfpp.so.$(libfpp-version)
+
+libfpp-objs  = common.o
+libfpp-objs += fdio.o
+libfpp-objs += libcatch.o
+libfpp-objs += libpush.o
+libfpp-objs += platform.o
+libfpp-objs += progress.o
+libfpp-objs += sha1.o
+libfpp-objs += sink.o
+libfpp-objs += source.o
+libfpp-objs += stats.o
+libfpp-objs += transport.o
+libfpp-objs += unixsock.o
+
+libfpp-headers  = $(src_topdir)/fpp.h
+libfpp-headers += $(src_topdir)/libcatch.h
+libfpp-headers += $(src_topdir)/libpush.h
+libfpp-headers += $(src_topdir)/progress.h
+libfpp-headers += $(src_topdir)/retval.h
+libfpp-headers += $(src_topdir)/sha1.h
+libfpp-headers += $(src_topdir)/sha1util.h
+libfpp-headers += $(src_topdir)/sink.h
+libfpp-headers += $(src_topdir)/source.h
+libfpp-headers += $(src_topdir)/stats.h
+libfpp-headers += $(src_topdir)/transport.h
+libfpp-headers += $(src_topdir)/posix/fdio.h
+libfpp-headers += $(src_topdir)/posix/libfpp.hpp
+libfpp-headers += $(src_topdir)/posix/platform.h
+libfpp-headers += $(src_topdir)/posix/unixsock.h
+
+libs += $(libfpp)
+
+impair: $(impair-objs)
+	$(CC) $(CFLAGS) $^ -o $@
+
+memloop: $(memloop-objs)
+	$(CC) $(CFLAGS) $^ -pthread -o $@
+
+nbloop: $(nbloop-objs)
+	$(CC) $(CFLAGS) $^ -o $@
+
+coloop: $(coloop-objs)
+	$(CXX) $(CXXFLAGS) $^ -o $@
+
+# Only the API declared in the installed headers is exported.
+$(libfpp): $(libfpp-objs) $(src_topdir)/posix/libfpp.map
+	$(CC) $(CFLAGS) -shared -Wl,-soname,$(libfpp-soname) \
+		-Wl,--version-script,$(src_topdir)/posix/libfpp.map \
+		$(libfpp-objs) -o $@
 
 install: all
 	install -Dm 0755 push $(PREFIX)/push
 	install -Dm 0755 catch $(PREFIX)/catch
+	install -Dm 0755 $(libfpp) $(LIBDIR)/$(libfpp)
+	ln -sf $(libfpp) $(LIBDIR)/$(libfpp-soname)
+	ln -sf $(libfpp-soname) $(LIBDIR)/libfpp.so
+	mkdir -p $(LIBDIR)/pkgconfig
+	sed -e 's|@LIBDIR@|$(LIBDIR)|' \
+	    -e 's|@INCLUDEDIR@|$(INCLUDEDIR)|' \
+	    -e 's|@VERSION@|$(libfpp-version)|' \
+	    $(src_topdir)/posix/libfpp.pc.in >$(LIBDIR)/pkgconfig/libfpp.pc
+	for h in $(libfpp-headers); do \
+		install -Dm 0644 $$h $(INCLUDEDIR)/fpp/$${h##*/}; \
+	done
@@ -0,0 +1,405 @@
+#ifndef LIBFPP_HPP
+#define LIBFPP_HPP
+
+/* C++20 interface to libfpp: pushes and catches are coroutines resumed by
+ * an epoll executor, so a single thread can serve many transfers at once.
+ *
+ *     fpp::Executor ex;
+ *     fpp::PushSession push(sockfd, "file.bin", std::as_bytes(span));
+ *     ex.spawn(push.run(ex));
+ *     ex.run();
+ *
+ * Sessions never own the sockets they are given, which are made
+ * non-blocking. A session must outlive the tasks returned by its run(),
+ * but it may be moved while they are running. */
+
+#include <array>
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+extern "C" {
+#include "fdio.h"
+#include "libcatch.h"
+#include "libpush.h"
+#include "sink.h"
+#include "source.h"
+#include "transport.h"
+}
+
+namespace fpp {
+
+template <typename T> class Task;
+
+namespace detail {
+
+/* Resume whoever awaits the finished task. */
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> h) noexcept
+    {
+        std::coroutine_handle<> cont = h.promise().continuation;
+        return cont ? cont : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+};
+
+/* Coroutine owning itself, which runs a spawned task to completion. */
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+inline void make_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        throw std::system_error(errno, std::generic_category(), "fcntl");
+}
+
+} // namespace detail
+
+/* Lazily started coroutine producing T, to be co_awaited exactly once. */
+template <typename T>
+class Task {
+public:
+    struct promise_type {
+        T value{};
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() noexcept
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        detail::FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(T v) { value = std::move(v); }
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    Task(Task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other) {
+            if (h_)
+                h_.destroy();
+            h_ = std::exchange(other.h_, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task()
+    {
+        if (h_)
+            h_.destroy();
+    }
+
+    bool await_ready() const noexcept { return !h_ || h_.done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept
+    {
+        h_.promise().continuation = cont;
+        return h_;
+    }
+
+    T await_resume()
+    {
+        if (h_.promise().error)
+            std::rethrow_exception(h_.promise().error);
+        return std::move(h_.promise().value);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+/* Single-threaded executor resuming coroutines waiting for sockets. */
+class Executor {
+public:
+    Executor() : epfd_(epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (epfd_ < 0)
+            throw std::system_error(errno, std::generic_category(),
+                                    "epoll_create1");
+    }
+    ~Executor() { close(epfd_); }
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    /* Awaitable suspending the coroutine until fd is ready for events
+     * (EPOLLIN or EPOLLOUT). Only one coroutine may wait for an fd. */
+    class Wait {
+    public:
+        Wait(Executor &ex, int fd, uint32_t events) noexcept
+            : ex_(ex), fd_(fd), events_(events) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            struct epoll_event ev = {};
+            ev.events = events_ | EPOLLONESHOT;
+            ev.data.ptr = h.address();
+
+            /* Descriptors stay registered, though disarmed, between waits. */
+            if (epoll_ctl(ex_.epfd_, EPOLL_CTL_MOD, fd_, &ev) != 0 &&
+                (errno != ENOENT ||
+                 epoll_ctl(ex_.epfd_, EPOLL_CTL_ADD, fd_, &ev) != 0))
+                throw std::system_error(errno, std::generic_category(),
+                                        "epoll_ctl");
+            ex_.waiting_++;
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        Executor &ex_;
+        int fd_;
+        uint32_t events_;
+    };
+
+    Wait wait(int fd, uint32_t events) noexcept
+    {
+        return Wait(*this, fd, events);
+    }
+
+    /* Stop watching fd, to be called before it is closed or handed over. */
+    void forget(int fd) noexcept
+    {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    /* Start the task, which then runs from within run(). Its result is
+     * discarded, and an exception escaping it terminates the program. */
+    template <typename T>
+    void spawn(Task<T> task)
+    {
+        [](Task<T> t) -> detail::Detached { co_await t; }(std::move(task));
+    }
+
+    /* Resume waiting coroutines until none is left. */
+    void run()
+    {
+        std::array<struct epoll_event, 64> events;
+
+        while (waiting_ > 0) {
+            int n = epoll_wait(epfd_, events.data(), events.size(), -1);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(),
+                                        "epoll_wait");
+            }
+            for (int i = 0; i < n; i++) {
+                waiting_--;
+                std::coroutine_handle<>::from_address(events[i].data.ptr)
+                    .resume();
+            }
+        }
+    }
+
+private:
+    int epfd_;
+    std::size_t waiting_ = 0;
+};
+
+/* Push of one file over a connected socket. */
+class PushSession {
+public:
+    /* Push content of the buffer, which is sent directly from where it is
+     * and must stay untouched until the push completes. */
+    PushSession(int sockfd, std::string filename,
+                std::span<const std::byte> data)
+        : st_(std::make_unique<State>(sockfd, std::move(filename)))
+    {
+        mem_source_init(&st_->src, data.data(), data.size());
+        st_->ctx.filelen = data.size();
+    }
+
+    /* Push the regular file open as filefd, mapped if possible. */
+    PushSession(int sockfd, std::string filename, int filefd)
+        : st_(std::make_unique<State>(sockfd, std::move(filename)))
+    {
+        int rv = mmap_source_init(&st_->src, filefd);
+        if (rv)
+            rv = fd_source_init(&st_->src, filefd);
+        if (!rv)
+            rv = st_->src.size(&st_->src, &st_->ctx.filelen);
+        if (rv)
+            throw std::system_error(EIO, std::generic_category(), "source");
+    }
+
+    PushSession(PushSession &&) noexcept = default;
+    PushSession &operator=(PushSession &&) noexcept = default;
+
+    /* Options such as calc_digest, forced and callbacks may be set here. */
+    struct push_context &context() noexcept { return st_->ctx; }
+
+    /* Push the file, yielding 0 or one of RV_* values. */
+    Task<int> run(Executor &ex) { return run(ex, st_.get()); }
+
+    /* Make the running push end with RV_TERMINATED. The executor notices
+     * once the socket gets ready again. */
+    void cancel() noexcept { st_->terminate = 1; }
+
+private:
+    struct State {
+        State(int sockfd, std::string name) : filename(std::move(name))
+        {
+            detail::make_nonblocking(sockfd);
+            sock_transport_init(&tr, sockfd);
+            ctx.filename = filename.c_str();
+            ctx.src = &src;
+            ctx.tr = &tr;
+            ctx.calc_digest = 1;
+            ctx.terminate = &terminate;
+        }
+        ~State()
+        {
+            if (src.close)
+                src.close(&src);
+        }
+        State(const State &) = delete;
+        State &operator=(const State &) = delete;
+
+        std::string filename;
+        struct push_context ctx = {};
+        struct transport tr = {};
+        struct source src = {};
+        volatile sig_atomic_t terminate = 0;
+    };
+
+    static Task<int> run(Executor &ex, State *st)
+    {
+        struct push_context *ctx = &st->ctx;
+        int status;
+
+        libpush_begin(ctx);
+        while ((status = libpush_continue(ctx)) != PUSH_DONE)
+            co_await ex.wait(ctx->tr->sk, status == PUSH_WANT_READ ?
+                                          EPOLLIN : EPOLLOUT);
+        ex.forget(ctx->tr->sk);
+        co_return ctx->rv;
+    }
+
+    std::unique_ptr<State> st_;
+};
+
+/* Catching of files pushed over a connected socket, one per run(). */
+class CatchSession {
+public:
+    /* Catch files into memory, see data(). */
+    explicit CatchSession(int sockfd)
+        : st_(std::make_unique<State>(sockfd))
+    {
+        mem_sink_init(&st_->sink);
+        st_->in_memory = true;
+    }
+
+    /* Catch files into directory dirfd (or AT_FDCWD). */
+    CatchSession(int sockfd, int dirfd)
+        : st_(std::make_unique<State>(sockfd))
+    {
+        fd_sink_init(&st_->sink, dirfd);
+    }
+
+    CatchSession(CatchSession &&) noexcept = default;
+    CatchSession &operator=(CatchSession &&) noexcept = default;
+
+    /* Options such as calc_digest, allow_forced and callbacks may be set
+     * here. */
+    struct catch_context &context() noexcept { return st_->ctx; }
+
+    /* Handle one request, yielding the same values as
+     * libcatch_handle_request(). */
+    Task<int> run(Executor &ex) { return run(ex, st_.get()); }
+
+    /* Make the running request end with RV_TERMINATED. */
+    void cancel() noexcept { st_->terminate = 1; }
+
+    /* Name of the file of the last request. */
+    std::string_view filename() const noexcept { return st_->filename.data(); }
+
+    /* Content of the file last caught into memory, valid until the next
+     * run() of the session. */
+    std::span<const std::byte> data() const noexcept
+    {
+        if (!st_->in_memory || !st_->sink.data)
+            return {};
+        return std::as_bytes(std::span<const unsigned char>(
+            st_->sink.data, static_cast<std::size_t>(st_->sink.len)));
+    }
+
+private:
+    struct State {
+        explicit State(int sockfd)
+        {
+            detail::make_nonblocking(sockfd);
+            sock_transport_init(&tr, sockfd);
+            ctx.filename = filename.data();
+            ctx.filenamesz = filename.size();
+            ctx.sink = &sink;
+            ctx.tr = &tr;
+            ctx.calc_digest = 1;
+            ctx.terminate = &terminate;
+        }
+        ~State()
+        {
+            if (in_memory)
+                mem_sink_free(&sink);
+        }
+        State(const State &) = delete;
+        State &operator=(const State &) = delete;
+
+        std::array<char, 4096> filename = {};
+        struct catch_context ctx = {};
+        struct transport tr = {};
+        struct sink sink = {};
+        bool in_memory = false;
+        volatile sig_atomic_t terminate = 0;
+    };
+
+    static Task<int> run(Executor &ex, State *st)
+    {
+        struct catch_context *ctx = &st->ctx;
+        int status;
+
+        libcatch_begin(ctx);
+        while ((status = libcatch_continue(ctx)) != CATCH_DONE)
+            co_await ex.wait(ctx->tr->sk, status == CATCH_WANT_READ ?
+                                          EPOLLIN : EPOLLOUT);
+        ex.forget(ctx->tr->sk);
+        co_return ctx->rv;
+    }
+
+    std::unique_ptr<State> st_;
+};
+
+} // namespace fpp
+
+#endif
@@ -0,0 +1,401 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "metrics.h"
+#include "unixsock.h"
+
+#define BUCKETS_MAX 8
+
+struct histogram {
+    const double *bounds;  /* upper bounds of the buckets */
+    int nbounds;
+    unsigned long counts[BUCKETS_MAX]; /* not cumulative */
+    unsigned long count;
+    double sum;
+};
+
+/* Results of requests counted separately, the last one stands for all
+ * others. */
+static const int results[] = {
+    0,
+    RV_COMPLETED_DIGEST_MISMATCH,
+    RV_DIGEST_MATCH,
+    RV_SIZE_MATCH,
+    RV_NACK,
+    RV_REJECT,
+    RV_LOCAL_BIGGER,
+    RV_NOT_REGULAR_FILE,
+    RV_TOOBIG,
+    RV_UNEXPECTED,
+    RV_TERMINATED,
+    RV_NETIOERROR,
+    RV_IOERROR,
+    -1
+};
+#define NRESULTS (sizeof results / sizeof results[0])
+
+/* Bytes per second from 100 kB/s to 10 GB/s and seconds. */
+static const double throughput_bounds[] = { 1e5, 1e6, 1e7, 1e8, 1e9, 1e10 };
+static const double handshake_bounds[] = {
+    0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long received;
+static unsigned long requests[NRESULTS];
+static unsigned long resumed_total;
+static unsigned long connections;
+static long active;
+static unsigned long mismatches;
+static unsigned long discoveries;
+static struct histogram throughput = {
+    throughput_bounds, sizeof throughput_bounds / sizeof(double), {0}, 0, 0
+};
+static struct histogram handshake = {
+    handshake_bounds, sizeof handshake_bounds / sizeof(double), {0}, 0, 0
+};
+
+static int listenfd = -1;
+static const char *unixpath;
+
+static void observe(struct histogram *h, double value)
+{
+    int i;
+
+    for (i = 0; i < h->nbounds && value > h->bounds[i]; i++)
+        ;
+    if (i < h->nbounds)
+        h->counts[i]++;
+    h->count++;
+    h->sum += value;
+}
+
+void metrics_connection(int delta)
+{
+    pthread_mutex_lock(&lock);
+    if (delta > 0)
+        connections++;
+    active += delta;
+    pthread_mutex_unlock(&lock);
+}
+
+void metrics_handshake(double seconds)
+{
+    pthread_mutex_lock(&lock);
+    observe(&handshake, seconds);
+    pthread_mutex_unlock(&lock);
+}
+
+void metrics_received(off_t bytes)
+{
+    pthread_mutex_lock(&lock);
+    received += bytes;
+    pthread_mutex_unlock(&lock);
+}
+
+void metrics_request(int rv, int resumed)
+{
+    size_t i;
+
+    for (i = 0; i < NRESULTS - 1 && results[i] != rv; i++)
+        ;
+
+    pthread_mutex_lock(&lock);
+    requests[i]++;
+    if (resumed && rv == 0)
+        resumed_total++;
+    if (rv == RV_COMPLETED_DIGEST_MISMATCH || rv == RV_NACK)
+        mismatches++;
+    pthread_mutex_unlock(&lock);
+}
+
+void metrics_throughput(double bytes_per_sec)
+{
+    pthread_mutex_lock(&lock);
+    observe(&throughput, bytes_per_sec);
+    pthread_mutex_unlock(&lock);
+}
+
+void metrics_discovery(void)
+{
+    pthread_mutex_lock(&lock);
+    discoveries++;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Text of the metrics, grown as needed. Once growing has failed, the rest
+ * is left out and failed is set. */
+struct output {
+    char *buf;
+    size_t len;
+    size_t size;
+    int failed;
+};
+
+static void out(struct output *o, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (o->failed)
+        return;
+
+    va_start(ap, fmt);
+    n = vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        o->failed = 1;
+        return;
+    }
+
+    if ((size_t)n >= o->size - o->len) {
+        size_t size = o->size * 2;
+        char *buf;
+
+        while (size - o->len <= (size_t)n)
+            size *= 2;
+        buf = realloc(o->buf, size);
+        if (!buf) {
+            o->failed = 1;
+            return;
+        }
+        o->buf = buf;
+        o->size = size;
+
+        va_start(ap, fmt);
+        vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+        va_end(ap);
+    }
+    o->len += n;
+}
+
+static void out_metric(struct output *o, const char *name, const char *type,
+                       const char *help)
+{
+    out(o, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void out_histogram(struct output *o, const char *name,
+                          const struct histogram *h)
+{
+    unsigned long count = 0;
+    int i;
+
+    for (i = 0; i < h->nbounds; i++) {
+        count += h->counts[i];
+        out(o, "%s_bucket{le=\"%g\"} %lu\n", name, h->bounds[i], count);
+    }
+    out(o, "%s_bucket{le=\"+Inf\"} %lu\n", name, h->count);
+    out(o, "%s_sum %g\n%s_count %lu\n", name, h->sum, name, h->count);
+}
+
+static void render(struct output *o)
+{
+    size_t i;
+
+    pthread_mutex_lock(&lock);
+
+    out_metric(o, "fpp_catch_received_bytes_total", "counter",
+               "Bytes of file content received.");
+    out(o, "fpp_catch_received_bytes_total %llu\n", received);
+
+    out_metric(o, "fpp_catch_requests_total", "counter",
+               "Push requests handled by result.");
+    for (i = 0; i < NRESULTS; i++)
+        out(o, "fpp_catch_requests_total{result=\"%s\"} %lu\n",
+            rv_name(results[i]), requests[i]);
+
+    out_metric(o, "fpp_catch_resumed_total", "counter",
+               "Transfers completed by resuming an earlier one.");
+    out(o, "fpp_catch_resumed_total %lu\n", resumed_total);
+
+    out_metric(o, "fpp_catch_digest_mismatches_total", "counter",
+               "Transfers or resumes with digests not matching.");
+    out(o, "fpp_catch_digest_mismatches_total %lu\n", mismatches);
+
+    out_metric(o, "fpp_catch_connections_total", "counter",
+               "Connections accepted.");
+    out(o, "fpp_catch_connections_total %lu\n", connections);
+
+    out_metric(o, "fpp_catch_connections_active", "gauge",
+               "Connections being handled.");
+    out(o, "fpp_catch_connections_active %ld\n", active);
+
+    out_metric(o, "fpp_catch_discovery_replies_total", "counter",
+               "Discovery requests answered.");
+    out(o, "fpp_catch_discovery_replies_total %lu\n", discoveries);
+
+    out_metric(o, "fpp_catch_throughput_bytes_per_second", "histogram",
+               "Throughput of completed transfers.");
+    out_histogram(o, "fpp_catch_throughput_bytes_per_second", &throughput);
+
+    out_metric(o, "fpp_catch_handshake_seconds", "histogram",
+               "Time from accepting a connection to its first request.");
+    out_histogram(o, "fpp_catch_handshake_seconds", &handshake);
+
+    pthread_mutex_unlock(&lock);
+}
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n > 0) {
+            buf += n;
+            len -= n;
+        } else if (n == 0 || errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Answer any HTTP request with the metrics. A client not sending its
+ * request within a second is not waited for longer. */
+static void serve_client(int fd)
+{
+    struct timeval tv = { 1, 0 };
+    struct output o;
+    char req[1024], head[256];
+    size_t reqlen = 0;
+
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    (void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+
+    while (reqlen < sizeof req - 1) {
+        ssize_t n = recv(fd, req + reqlen, sizeof req - 1 - reqlen, 0);
+        if (n <= 0)
+            return;
+        reqlen += n;
+        req[reqlen] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+            break;
+    }
+
+    o.size = 8192;
+    o.len = 0;
+    o.failed = 0;
+    o.buf = malloc(o.size);
+    if (o.buf)
+        render(&o);
+    if (!o.buf || o.failed) {
+        static const char error[] =
+            "HTTP/1.0 500 Internal Server Error\r\n"
+            "Connection: close\r\n\r\n";
+
+        err("Cannot render metrics: Out of memory");
+        (void)send_all(fd, error, sizeof error - 1);
+        free(o.buf);
+        return;
+    }
+
+    snprintf(head, sizeof head,
+             "HTTP/1.0 200 OK\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %lu\r\n"
+             "Connection: close\r\n\r\n", (unsigned long)o.len);
+
+    if (send_all(fd, head, strlen(head)) == 0)
+        (void)send_all(fd, o.buf, o.len);
+    free(o.buf);
+}
+
+static void *serve(void *arg)
+{
+    UNUSED(arg);
+
+    for (;;) {
+        int fd = accept(listenfd, NULL, NULL);
+
+        if (fd >= 0) {
+            serve_client(fd);
+            close(fd);
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            err_errno("Cannot accept metrics connection");
+            sleep(1);
+        }
+    }
+    return NULL;
+}
+
+static int listen_tcp(const char *addr)
+{
+    struct sockaddr_in sa;
+    const char *colon = strrchr(addr, ':');
+    const char *port = colon ? colon + 1 : addr;
+    char host[64] = "127.0.0.1";
+    char *end;
+    unsigned long portnum = strtoul(port, &end, 10);
+    int optval = 1;
+    int fd;
+
+    if (colon) {
+        if ((size_t)(colon - addr) >= sizeof host)
+            die("Invalid metrics address %s", addr);
+        memcpy(host, addr, colon - addr);
+        host[colon - addr] = '\0';
+    }
+
+    memset(&sa, '\0', sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(portnum);
+    if (*port == '\0' || *end != '\0' || portnum > 65535 ||
+        inet_pton(AF_INET, host, &sa.sin_addr) != 1)
+        die("Invalid metrics address %s", addr);
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0)
+        die_errno("Cannot create TCP socket");
+
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
+
+    if (bind(fd, (struct sockaddr *)&sa, sizeof sa) != 0)
+        die_errno("Cannot bind to %s", addr);
+    return fd;
+}
+
+void metrics_start(const char *addr)
+{
+    size_t prefixlen = strlen(UNIX_PEER_PREFIX);
+    sigset_t all, old;
+    pthread_t thread;
+    int rv;
+
+    if (!strncmp(addr, UNIX_PEER_PREFIX, prefixlen)) {
+        unixpath = addr + prefixlen;
+        listenfd = unix_listen(unixpath, 4);
+        if (listenfd < 0)
+            die_errno("Cannot listen to %s", unixpath);
+    } else {
+        listenfd = listen_tcp(addr);
+        if (listen(listenfd, 4) != 0)
+            die_errno("Cannot listen to %s", addr);
+    }
+
+    /* Signals must interrupt system calls of the main thread. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    rv = pthread_create(&thread, NULL, serve, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rv != 0)
+        die("Cannot start metrics thread");
+    pthread_detach(thread);
+}
+
+void metrics_stop(void)
+{
+    if (unixpath)
+        unlink(unixpath);
+}
@@ -0,0 +1,34 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sys/types.h>
+
+/* Counters of catch, served over HTTP in Prometheus text format by a thread
+ * of its own, so they can be scraped during transfers too. The functions
+ * recording them may be called whether the metrics are served or not. */
+
+/* Serve the metrics on "unix:PATH" or "[HOST:]PORT" (127.0.0.1 unless
+ * HOST is given) from now on. Dies on failure. */
+void metrics_start(const char *addr);
+
+/* Remove the UNIX domain socket of the metrics, if any. */
+void metrics_stop(void);
+
+/* A connection has been opened (delta 1) or closed (delta -1). */
+void metrics_connection(int delta);
+
+/* The first request of a connection came the seconds after its accept. */
+void metrics_handshake(double seconds);
+
+/* Bytes of content have been received. */
+void metrics_received(off_t bytes);
+
+/* A request has ended with rv, resuming an earlier transfer if resumed is
+ * set. Completed transfers also report their throughput. */
+void metrics_request(int rv, int resumed);
+void metrics_throughput(double bytes_per_sec);
+
+/* A discovery request has been answered. */
+void metrics_discovery(void);
+
+#endif
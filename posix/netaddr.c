@@ -0,0 +1,71 @@
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+
+#include "netaddr.h"
+
+socklen_t netaddr_len(const struct sockaddr_storage *ss)
+{
+    switch (ss->ss_family) {
+    case AF_INET:
+        return sizeof(struct sockaddr_in);
+    case AF_INET6:
+        return sizeof(struct sockaddr_in6);
+    }
+    return 0;
+}
+
+void netaddr_set_port(struct sockaddr_storage *ss, unsigned short port)
+{
+    if (ss->ss_family == AF_INET)
+        ((struct sockaddr_in *)ss)->sin_port = htons(port);
+    else if (ss->ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)ss)->sin6_port = htons(port);
+}
+
+int netaddr_equal(const struct sockaddr_storage *a,
+                  const struct sockaddr_storage *b)
+{
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)a;
+    const struct sockaddr_in *b4 = (const struct sockaddr_in *)b;
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a;
+    const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *)b;
+
+    if (a->ss_family != b->ss_family)
+        return 0;
+    if (a->ss_family == AF_INET)
+        return a4->sin_port == b4->sin_port &&
+               a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    if (a->ss_family == AF_INET6)
+        return a6->sin6_port == b6->sin6_port &&
+               a6->sin6_scope_id == b6->sin6_scope_id &&
+               !memcmp(&a6->sin6_addr, &b6->sin6_addr,
+                       sizeof a6->sin6_addr);
+    return 0;
+}
+
+const char *netaddr_str(const struct sockaddr_storage *ss)
+{
+    static char buf[NI_MAXHOST];
+
+    if (getnameinfo((const struct sockaddr *)ss, netaddr_len(ss),
+                    buf, sizeof buf, NULL, 0, NI_NUMERICHOST) != 0)
+        strcpy(buf, "?");
+    return buf;
+}
+
+int netaddr_parse(const char *str, struct sockaddr_storage *ss)
+{
+    struct addrinfo hints, *res;
+
+    memset(&hints, '\0', sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_flags = AI_NUMERICHOST;
+
+    if (getaddrinfo(str, NULL, &hints, &res) != 0)
+        return -1;
+    memset(ss, '\0', sizeof *ss);
+    memcpy(ss, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    return 0;
+}
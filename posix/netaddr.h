@@ -0,0 +1,25 @@
+#ifndef NETADDR_H
+#define NETADDR_H
+
+#include <sys/socket.h>
+
+/* Socket addresses of either IPv4 or IPv6. */
+
+/* Length of the address of its family, 0 if it is neither. */
+socklen_t netaddr_len(const struct sockaddr_storage *ss);
+
+void netaddr_set_port(struct sockaddr_storage *ss, unsigned short port);
+
+/* Return 1 if a and b are the same address and port, 0 if not. */
+int netaddr_equal(const struct sockaddr_storage *a,
+                  const struct sockaddr_storage *b);
+
+/* Numeric text of the address, with the scope of a link-local IPv6 one as
+ * in "fe80::1%eth0", in a buffer overwritten by the next call. */
+const char *netaddr_str(const struct sockaddr_storage *ss);
+
+/* Parse numeric text of an address of either family into ss, return 0 on
+ * success or -1 if it is no address. */
+int netaddr_parse(const char *str, struct sockaddr_storage *ss);
+
+#endif
@@ -0,0 +1,180 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "netaddr.h"
+#include "peercache.h"
+
+#define PEERCACHE_MAX 64 /* peers kept, the most recently found ones */
+
+/* Lines of the file are "ADDRESS EXPIRES PEERNAME", the address of either
+ * family and the expiry time in seconds since the Epoch. */
+struct entry {
+    struct sockaddr_storage addr;
+    long expires;
+    char name[PEERNAME_MAX + 1];
+};
+
+static struct entry entries[PEERCACHE_MAX];
+static int nentries;
+
+/* Path of the cache file or NULL if there is none, creating the directory
+ * of the default one. */
+static const char *cache_path(void)
+{
+    static char path[PATH_MAX];
+    const char *env = getenv("PUSH_PEER_CACHE");
+    const char *dir = getenv("XDG_CACHE_HOME");
+
+    if (env)
+        return *env ? env : NULL;
+
+    if (dir && *dir) {
+        snprintf(path, sizeof path, "%s", dir);
+    } else if ((dir = getenv("HOME")) && *dir) {
+        snprintf(path, sizeof path, "%s/.cache", dir);
+    } else {
+        return NULL;
+    }
+    if (mkdir(path, 0700) != 0 && errno != EEXIST)
+        return NULL;
+
+    if (strlen(path) + sizeof "/push-peers" > sizeof path)
+        return NULL;
+    strcat(path, "/push-peers");
+    return path;
+}
+
+/* Read entries not expired yet. */
+static void load(const char *path)
+{
+    char line[PEERNAME_MAX + 64];
+    long now = time(NULL);
+    FILE *fp = fopen(path, "r");
+
+    nentries = 0;
+    if (!fp)
+        return;
+
+    while (nentries < PEERCACHE_MAX && fgets(line, sizeof line, fp)) {
+        struct entry *e = &entries[nentries];
+        char addr[64];
+        size_t len;
+        int pos;
+
+        if (sscanf(line, "%63s %ld %n", addr, &e->expires, &pos) != 2 ||
+            netaddr_parse(addr, &e->addr) != 0 || e->expires <= now)
+            continue;
+
+        len = strcspn(line + pos, "\n");
+        if (len == 0 || len > PEERNAME_MAX)
+            continue;
+        memcpy(e->name, line + pos, len);
+        e->name[len] = '\0';
+        nentries++;
+    }
+    fclose(fp);
+}
+
+/* Replace the file with the entries, so concurrent pushes never see it
+ * written halfway. */
+static void save(const char *path)
+{
+    char tmp[PATH_MAX];
+    FILE *fp;
+    int i;
+
+    if ((size_t)snprintf(tmp, sizeof tmp, "%s.%ld", path,
+                         (long)getpid()) >= sizeof tmp)
+        return;
+
+    fp = fopen(tmp, "w");
+    if (!fp)
+        return;
+    for (i = 0; i < nentries; i++)
+        fprintf(fp, "%s %ld %s\n", netaddr_str(&entries[i].addr),
+                entries[i].expires, entries[i].name);
+
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+        unlink(tmp);
+}
+
+static int find(const char *peername)
+{
+    int i;
+
+    for (i = 0; i < nentries; i++)
+        if (!strcmp(entries[i].name, peername))
+            return i;
+    return -1;
+}
+
+static void remove_entry(int i)
+{
+    memmove(&entries[i], &entries[i + 1],
+            (nentries - i - 1) * sizeof entries[0]);
+    nentries--;
+}
+
+int peercache_lookup(const char *peername, struct sockaddr_storage *addr)
+{
+    const char *path = cache_path();
+    int i;
+
+    if (!path)
+        return 0;
+
+    load(path);
+    i = find(peername);
+    if (i < 0)
+        return 0;
+    *addr = entries[i].addr;
+    return 1;
+}
+
+void peercache_store(const char *peername,
+                     const struct sockaddr_storage *addr)
+{
+    const char *path = cache_path();
+    int i;
+
+    if (!path || strlen(peername) > PEERNAME_MAX)
+        return;
+
+    load(path);
+    i = find(peername);
+    if (i >= 0)
+        remove_entry(i);
+    else if (nentries == PEERCACHE_MAX)
+        remove_entry(0);
+
+    /* The most recently found peer goes last. */
+    entries[nentries].addr = *addr;
+    netaddr_set_port(&entries[nentries].addr, 0);
+    entries[nentries].expires = (long)time(NULL) + PEERCACHE_TTL;
+    strcpy(entries[nentries].name, peername);
+    nentries++;
+    save(path);
+}
+
+void peercache_forget(const char *peername)
+{
+    const char *path = cache_path();
+    int i;
+
+    if (!path)
+        return;
+
+    load(path);
+    i = find(peername);
+    if (i >= 0) {
+        remove_entry(i);
+        save(path);
+    }
+}
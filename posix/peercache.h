@@ -0,0 +1,24 @@
+#ifndef PEERCACHE_H
+#define PEERCACHE_H
+
+#include <sys/socket.h>
+
+#define PEERCACHE_TTL (24 * 60 * 60) /* seconds addresses are trusted for */
+
+/* Addresses of peers found by broadcast discovery, kept in a file so later
+ * pushes need not discover them again. The file is $PUSH_PEER_CACHE, or
+ * push-peers in $XDG_CACHE_HOME or ~/.cache, and it is not used at all if
+ * $PUSH_PEER_CACHE is set but empty. Failures to access it are ignored. */
+
+/* Store address of peername, without port, and return 1 if it is cached
+ * and not expired, return 0 otherwise. */
+int peercache_lookup(const char *peername, struct sockaddr_storage *addr);
+
+/* Cache the address of peername. */
+void peercache_store(const char *peername,
+                     const struct sockaddr_storage *addr);
+
+/* Remove the address of peername from the cache. */
+void peercache_forget(const char *peername);
+
+#endif
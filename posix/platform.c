@@ -1,11 +1,15 @@
 #include "common.h"
 #include "platform.h"
+#include "transport.h"
 #include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 
 #define PATHSEP '/'
 
@@ -41,44 +45,101 @@ int get_filelen(const char *filename, off_t *filelen)
     return rv;
 }
 
-/* Returns 0 if entire buffer was sent, or error number otherwise. */
-int send_entire(Sock sk, const void *buf, size_t len)
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
+static int send_result(ssize_t n, size_t *nsent)
 {
-    size_t nleft = len;
-    const char *ptr = buf;
-
-    while (!terminate && nleft > 0) {
-        ssize_t nsent = send(sk, ptr, nleft, MSG_NOSIGNAL);
-        if (nsent >= 0) {
-            nleft -= nsent;
-            ptr += nsent;
-        } else if (errno == EPIPE || errno == ECONNRESET) {
-            /* Peer closed the connection. */
-            return RV_CONNCLOSED;
-        } else if (errno != EINTR) {
-            return RV_NETIOERROR;
-        }
+    *nsent = 0;
+    if (n >= 0) {
+        *nsent = n;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return RV_WOULDBLOCK;
+    } else if (errno == EPIPE || errno == ECONNRESET) {
+        /* Peer closed the connection. */
+        return RV_CONNCLOSED;
+    } else if (errno != EINTR) {
+        return RV_NETIOERROR;
     }
-    return nleft ? RV_TERMINATED : 0;
+    return 0;
+}
+
+/* Returns 0 and number of bytes sent (possibly 0 if interrupted by a signal),
+ * RV_WOULDBLOCK if non-blocking socket is not ready, or error number. */
+int send_some(Sock sk, const void *buf, size_t len, size_t *nsent)
+{
+    return send_result(send(sk, buf, len, MSG_NOSIGNAL), nsent);
 }
 
-/* Returns 0 if entire buffer was received, or error number otherwise. */
-int recv_entire(Sock sk, void *buf, size_t len)
+/* Same as send_some(), but the segments go out as one message. Unless more
+ * is zero, the kernel may hold back a partial packet until more data come. */
+int send_somev(Sock sk, const struct tr_iovec *iov, int iovcnt, int more,
+               size_t *nsent)
 {
-    size_t nleft = len;
-    char *ptr = buf;
-
-    while (!terminate && nleft > 0) {
-        ssize_t nreceived = recv(sk, ptr, nleft, 0);
-        if (nreceived > 0) {
-            nleft -= nreceived;
-            ptr += nreceived;
-        } else if (nreceived == 0) {
-            /* Peer closed the connection. */
-            return RV_CONNCLOSED;
-        } else if (errno != EINTR) {
-            return RV_NETIOERROR;
-        }
+    struct iovec vec[TR_IOVMAX];
+    struct msghdr msg;
+    int i;
+
+    for (i = 0; i < iovcnt && i < TR_IOVMAX; i++) {
+        vec[i].iov_base = (void *)iov[i].base;
+        vec[i].iov_len = iov[i].len;
+    }
+    memset(&msg, '\0', sizeof msg);
+    msg.msg_iov = vec;
+    msg.msg_iovlen = i;
+
+    return send_result(sendmsg(sk, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0)),
+                       nsent);
+}
+
+/* Returns 0 and number of bytes received (possibly 0 if interrupted by
+ * a signal), RV_WOULDBLOCK if non-blocking socket is not ready,
+ * or error number. */
+int recv_some(Sock sk, void *buf, size_t len, size_t *nreceived)
+{
+    ssize_t n = recv(sk, buf, len, 0);
+
+    *nreceived = 0;
+    if (n > 0) {
+        *nreceived = n;
+    } else if (n == 0) {
+        /* Peer closed the connection. */
+        return RV_CONNCLOSED;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return RV_WOULDBLOCK;
+    } else if (errno != EINTR) {
+        return RV_NETIOERROR;
     }
-    return nleft ? RV_TERMINATED : 0;
+    return 0;
+}
+
+/* Returns 0 once the socket is ready (or has failed, which the next
+ * transfer tells), or if interrupted by a signal, or error number. */
+int wait_ready(Sock sk, int writing)
+{
+    struct pollfd pfd;
+
+    pfd.fd = sk;
+    pfd.events = writing ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        return RV_NETIOERROR;
+    return 0;
+}
+
+static double seconds(clockid_t clk)
+{
+    struct timespec ts;
+
+    if (clock_gettime(clk, &ts) != 0)
+        return 0;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void get_clocks(double *wall, double *cpu)
+{
+    *wall = seconds(CLOCK_MONOTONIC);
+    if (cpu)
+        *cpu = seconds(CLOCK_THREAD_CPUTIME_ID);
 }
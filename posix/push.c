@@ -1,6 +1,10 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,9 +16,37 @@
 #include <unistd.h>
 
 #include "common.h"
+#include "discovery.h"
+#include "fdio.h"
+#include "ifaces.h"
 #include "libpush.h"
+#include "netaddr.h"
+#include "peercache.h"
+#include "tune.h"
+#include "unixsock.h"
+
+#define PROBE_TIMEOUT_MS 300 /* for a cached peer to answer discovery */
+#define DISCOVERY_TIMEOUT_MS 5000
+#define COLLECT_MS 20 /* for more catches of the name to reply */
+#define BROADCAST_MAX 1024 /* addresses discovery is sent to */
+#define CANDIDATES_MAX 8 /* addresses of a peer tried */
+#define ATTEMPT_DELAY_MS 250 /* before connecting to the next address too */
+
+/* Discovery is sent again after these intervals, the last one repeating,
+ * so peers on a quiet LAN are found at once and lost datagrams are
+ * retried soon without flooding a busy network. */
+static const uint32_t resend_ms[] = { 10, 30, 100, 300, 1000 };
 
 static int forced = 0;
+static uint32_t discovery_timeout_ms = DISCOVERY_TIMEOUT_MS;
+static int show_stats = 0;
+static int calc_digest = 1;
+static int sparse;             /* holes are left out whether catch tells */
+static unsigned int peer_caps; /* DISCOVERY_CAP_* the catch discovered has */
+static struct xfer_stats stats;
+static size_t chunksize;
+static int progress_shown;     /* line of progress is yet to be ended */
+static unsigned char *chunkbuf;
 
 static void signal_handler(int signum)
 {
@@ -22,172 +54,695 @@ static void signal_handler(int signum)
     terminate = 1;
 }
 
-#if defined(__FreeBSD__) || defined(BSD) || defined(__APPLE__) || defined(__linux__)
-# include <ifaddrs.h>
-# include <net/if.h>
-#else
-#error Not implemented for this platform
-#endif
+static uint32_t clock_get_monotonic(void)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint32_t)(tp.tv_sec * 1000 + tp.tv_nsec / 1000000L);
+}
 
-struct in_addr *iterate_broadcast_addresses(struct in_addr *prev)
+/* Discovery is sent from a socket of each family, the one of IPv6 being -1
+ * if the host has no IPv6. */
+struct discovery_socks {
+    int fd4;
+    int fd6;
+};
+
+/* Send the request of the current version, and unless it is the first one
+ * sent, also that of version 1, as the win32 catch of version 1 fails on
+ * longer requests and would never reply otherwise. */
+static void send_request(int fd, const struct sockaddr_storage *ss,
+                         int retry)
 {
-    static struct ifaddrs *ifap = NULL;
-    static struct ifaddrs *pos = NULL;
-    static struct in_addr *last = NULL;
-    struct in_addr *next = NULL;
+    unsigned char req[DISCOVERY_REQ_LEN];
+    size_t reqlen = discovery_request(req);
+
+    info("Send discovery to %s", netaddr_str(ss));
+    if (sendto(fd, (char *)req, reqlen, 0, (const struct sockaddr *)ss,
+               netaddr_len(ss)) != (ssize_t)reqlen)
+        err_errno("sendto");
+    if (retry && sendto(fd, (char *)req, 1, 0, (const struct sockaddr *)ss,
+                        netaddr_len(ss)) != 1)
+        err_errno("sendto");
+}
 
-    if (!prev) {
-        /* New round of iterations invalidates ongoing */
-        if (ifap)
-            freeifaddrs(ifap);
+/* Send discovery to dest, or to all broadcast addresses and to the group
+ * on all interfaces of IPv6 if it is NULL. */
+static void send_discovery(const struct discovery_socks *ds,
+                           const struct sockaddr_storage *dest, int retry)
+{
+    struct in_addr addrs[BROADCAST_MAX];
+    unsigned int indexes[BROADCAST_MAX];
+    struct sockaddr_storage ss;
+    int i, n;
+
+    if (dest) {
+        if (dest->ss_family == AF_INET6 && ds->fd6 >= 0)
+            send_request(ds->fd6, dest, retry);
+        else if (dest->ss_family == AF_INET)
+            send_request(ds->fd4, dest, retry);
+        return;
+    }
 
-        if (getifaddrs(&ifap) != 0)
-            ifap = NULL;
+    n = ifaces_broadcast(addrs, BROADCAST_MAX);
+    for (i = 0; i < n; i++) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
 
-        pos = ifap;
-    } else if (prev != last) {
-        return NULL;
+        memset(&ss, '\0', sizeof ss);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(CATCH_PORT);
+        sin->sin_addr = addrs[i];
+        send_request(ds->fd4, &ss, retry);
     }
 
-    if (ifap) {
-        if (pos) {
-            for (; pos; pos = pos->ifa_next) {
-                if ((pos->ifa_flags & IFF_BROADCAST) && pos->ifa_broadaddr
-                        && pos->ifa_broadaddr->sa_family == AF_INET) {
-                    last = &((struct sockaddr_in *)pos->ifa_broadaddr)->sin_addr;
-                    next = last;
-                    break;
-                }
-            }
-            if (pos)
-                pos = pos->ifa_next;
-        } else {
-           freeifaddrs(ifap);
-           pos = ifap = NULL;
-        }
+    n = (ds->fd6 >= 0) ? ifaces_multicast6(indexes, BROADCAST_MAX) : 0;
+    for (i = 0; i < n; i++) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+
+        memset(&ss, '\0', sizeof ss);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(CATCH_PORT);
+        sin6->sin6_scope_id = indexes[i];
+        inet_pton(AF_INET6, DISCOVERY_GROUP6, &sin6->sin6_addr);
+        send_request(ds->fd6, &ss, retry);
     }
+}
 
-    return next;
+/* Return 1 if catch of status a suits this push better than b, 0 if not.
+ * Catches of version 1 tell nothing, so they are taken for idle ones with
+ * no disk space free. */
+static int less_loaded(const struct peer_status *a, const struct peer_status *b)
+{
+    int a_fits = (a->version < 2) ||
+                 (!!(a->caps & DISCOVERY_CAP_DIGEST) == calc_digest &&
+                  (!forced || (a->caps & DISCOVERY_CAP_FORCED)));
+    int b_fits = (b->version < 2) ||
+                 (!!(b->caps & DISCOVERY_CAP_DIGEST) == calc_digest &&
+                  (!forced || (b->caps & DISCOVERY_CAP_FORCED)));
+
+    if (a_fits != b_fits)
+        return a_fits;
+    if (a->transfers != b->transfers)
+        return a->transfers < b->transfers;
+    if (a->rate_kib != b->rate_kib)
+        return a->rate_kib < b->rate_kib;
+    return a->free_mib > b->free_mib;
 }
 
-static uint32_t clock_get_monotonic(void)
+/* Receive all replies pending, and store the address of the catch of
+ * peername suiting best so far in addr and its status in best. A catch
+ * replying over both IPv4 and IPv6 ties with itself, so the path its first
+ * reply has come by is kept. Return the number of replies from catches of
+ * peername, not counting another one from the address picked. */
+static int receive_replies(int sockfd, const char *peername,
+                           struct sockaddr_storage *addr,
+                           struct peer_status *best, int found)
 {
-    struct timespec tp;
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    return (uint32_t)(tp.tv_sec * 1000 + tp.tv_nsec / 1000000L);
+    unsigned char buf[DISCOVERY_REPLY_MAX];
+    char name[PEERNAME_MAX + 1];
+    struct peer_status st;
+    struct sockaddr_storage ss;
+    socklen_t ss_len = sizeof ss;
+    ssize_t len;
+    int n = 0;
+
+    while ((len = recvfrom(sockfd, (char *)buf, sizeof buf, MSG_DONTWAIT,
+                           (struct sockaddr *)&ss, &ss_len)) > 0) {
+        if (netaddr_len(&ss) && discovery_parse(buf, len, name, &st) == 0) {
+            if (st.version >= 2)
+                info("Peer %s found at %s (%u transfers, %lu MiB free, "
+                     "%lu KiB/s)", name, netaddr_str(&ss),
+                     st.transfers, (unsigned long)st.free_mib,
+                     (unsigned long)st.rate_kib);
+            else
+                info("Peer %s found at %s", name, netaddr_str(&ss));
+
+            if (!strcmp(name, peername) && found &&
+                netaddr_equal(&ss, addr)) {
+                /* A later catch replies to retries of version 1 too, which
+                 * tells less than its other reply. */
+                if (st.version > best->version)
+                    *best = st;
+            } else if (!strcmp(name, peername)) {
+                if (!found++ || less_loaded(&st, best)) {
+                    *addr = ss;
+                    *best = st;
+                }
+                n++;
+            }
+        }
+        ss_len = sizeof ss;
+    }
+    return n;
 }
 
-static int discover_peer(int sockfd, const char *peername, struct in_addr *inp)
+/* Send discovery to dest, or to all broadcast addresses and groups if it
+ * is NULL, again and again until the peer replies or timeout_ms is over.
+ * Several catches may share a name, so replies to broadcasts are collected
+ * for COLLECT_MS more and the least loaded catch is picked, its address
+ * stored in addr and its status in st. Return 1 if the peer has replied, 0
+ * if not, or -1 as soon as wakefd (unless -1) becomes readable. */
+static int discover_peer(const struct discovery_socks *ds,
+                         const char *peername,
+                         const struct sockaddr_storage *dest,
+                         uint32_t timeout_ms, int wakefd,
+                         struct sockaddr_storage *addr,
+                         struct peer_status *st)
 {
-    uint8_t req = DISCOVERY_VER;
     uint32_t start_ms = clock_get_monotonic();
-    struct in_addr *bcast_addr = NULL;
-    struct sockaddr_in sa;
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(CATCH_PORT);
-
-    while ((bcast_addr = iterate_broadcast_addresses(bcast_addr))) {
-        sa.sin_addr = *bcast_addr;
-        info("Send discovery to %s", inet_ntoa(sa.sin_addr));
-        if (sendto(sockfd, (char *)&req, sizeof req, 0,
-                    (struct sockaddr *)&sa, sizeof sa) != sizeof req)
-            err_errno("sendto");
-    }
+    uint32_t resend_at_ms = 0;     /* since start_ms */
+    unsigned int sent = 0;
+    struct peer_status best;
+    int found = 0;
 
     while (!terminate) {
-        int retval;
+        int retval, maxfd;
         struct timeval tv;
         uint32_t elapsed_ms, remaining_ms;
         fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(sockfd, &rfds);
 
-        /* Wait up to one second. */
         elapsed_ms = clock_get_monotonic() - start_ms;
-        if (elapsed_ms >= 1000)
+        if (elapsed_ms >= timeout_ms)
             break;
-        remaining_ms = 1000 - elapsed_ms;
-        tv.tv_sec = 0;
-        tv.tv_usec = remaining_ms * 1000;
+        if (elapsed_ms >= resend_at_ms) {
+            send_discovery(ds, dest, sent > 0);
+            resend_at_ms = elapsed_ms + resend_ms[sent];
+            if (sent < sizeof resend_ms / sizeof resend_ms[0] - 1)
+                sent++;
+        }
+
+        remaining_ms = ((timeout_ms < resend_at_ms) ? timeout_ms
+                                                    : resend_at_ms)
+                       - elapsed_ms;
+        tv.tv_sec = remaining_ms / 1000;
+        tv.tv_usec = remaining_ms % 1000 * 1000;
 
-        retval = select(sockfd + 1, &rfds, NULL, NULL, &tv);
+        /* Once the peer has replied, the caller has to wait no more. */
+        if (found)
+            wakefd = -1;
+
+        FD_ZERO(&rfds);
+        FD_SET(ds->fd4, &rfds);
+        maxfd = ds->fd4;
+        if (ds->fd6 >= 0) {
+            FD_SET(ds->fd6, &rfds);
+            if (ds->fd6 > maxfd)
+                maxfd = ds->fd6;
+        }
+        if (wakefd >= 0) {
+            FD_SET(wakefd, &rfds);
+            if (wakefd > maxfd)
+                maxfd = wakefd;
+        }
+
+        retval = select(maxfd + 1, &rfds, NULL, NULL, &tv);
 
         if (retval == -1 && errno != EINTR)
             die_errno("select()");
+        else if (retval > 0 && wakefd >= 0 && FD_ISSET(wakefd, &rfds))
+            return -1;
         else if (retval > 0) {
-            char buf[PEERNAME_MAX+2]; /* len byte + PEERNAME_MAX + nul */
-            struct sockaddr_storage ss;
-            socklen_t ss_len = sizeof ss;
-            if (recvfrom(sockfd, buf, sizeof buf, 0,
-                         (struct sockaddr *)&ss, &ss_len) > 0) {
-                size_t namelen = (uint8_t)buf[0];
-                char *name = &buf[1];
-                name[namelen] = '\0';
-
-                if (ss.ss_family == AF_INET) {
-                    struct sockaddr_in *s = (struct sockaddr_in *)&ss;
-                    info("Peer %s found at %s", name, inet_ntoa(s->sin_addr));
-                    if (!strcmp(name, peername)) {
-                        *inp = s->sin_addr;
-                        return 1;
-                    }
-                }
+            int n = 0;
+
+            if (FD_ISSET(ds->fd4, &rfds))
+                n += receive_replies(ds->fd4, peername, addr, &best,
+                                     found + n);
+            if (ds->fd6 >= 0 && FD_ISSET(ds->fd6, &rfds))
+                n += receive_replies(ds->fd6, peername, addr, &best,
+                                     found + n);
+
+            if (n && dest) {
+                *st = best;
+                return 1;
             }
+            if (n && !found) {
+                /* Another catch of the name may only reply a little later. */
+                elapsed_ms = clock_get_monotonic() - start_ms;
+                if (timeout_ms > elapsed_ms + COLLECT_MS)
+                    timeout_ms = elapsed_ms + COLLECT_MS;
+                resend_at_ms = timeout_ms;
+            }
+            found += n;
         }
     }
-    return 0;
+    if (found > 1)
+        info("Picked peer %s at %s of %d replies", peername,
+             netaddr_str(addr), found);
+    if (found)
+        *st = best;
+    return found > 0;
 }
 
-static void resolve_peername(const char *peername, struct in_addr *inp)
+static void discovery_open(struct discovery_socks *ds)
 {
-    int sockfd;
     struct sockaddr_in sa;
+    struct sockaddr_in6 sa6;
     int optval = 1;
-    int i;
-
-    /* Negative answers from DNS resolver can be annoyingly slow,
-     * so the at sign before peername can be used to avoid using DNS to
-     * resolve peername and start broadcast discovery immediately. */
-    if (peername[0] != '@') {
-        struct hostent *hent = gethostbyname(peername);
 
-        if (hent) {
-            *inp = *(struct in_addr *)hent->h_addr;
-            if (inp->s_addr != INADDR_NONE)
-                return;
-        }
-    } else {
-        peername++;
-    }
-
-    /* Otherwise discover peer using broadcast UDP request */
-    sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (sockfd < 0)
+    ds->fd4 = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (ds->fd4 < 0)
         die_errno("Cannot create UDP socket");
 
+    memset(&sa, '\0', sizeof sa);
     sa.sin_family = AF_INET;
     sa.sin_port = 0;
     sa.sin_addr.s_addr = INADDR_ANY;
 
-    if (setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, (void *)&optval, sizeof optval) != 0)
+    if (setsockopt(ds->fd4, SOL_SOCKET, SO_BROADCAST, (void *)&optval, sizeof optval) != 0)
         die_errno("setsockopt(SO_BROADCAST) failed");
 
-    if (bind(sockfd, (struct sockaddr *)&sa, sizeof sa) != 0)
+    if (bind(ds->fd4, (struct sockaddr *)&sa, sizeof sa) != 0)
         die_errno("Cannot bind UDP socket to INADDR_ANY");
 
+    /* Hosts without IPv6 discover over IPv4 only. */
+    ds->fd6 = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+    if (ds->fd6 < 0)
+        return;
+
+    memset(&sa6, '\0', sizeof sa6);
+    sa6.sin6_family = AF_INET6;
+    sa6.sin6_addr = in6addr_any;
+
+    if (setsockopt(ds->fd6, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&optval,
+                   sizeof optval) != 0 ||
+        bind(ds->fd6, (struct sockaddr *)&sa6, sizeof sa6) != 0) {
+        close(ds->fd6);
+        ds->fd6 = -1;
+    }
+}
+
+static void discovery_close(struct discovery_socks *ds)
+{
+    close(ds->fd4);
+    if (ds->fd6 >= 0)
+        close(ds->fd6);
+}
+
+/* Addresses the peer may be reached at, in the order to try them. */
+struct candidates {
+    struct sockaddr_storage addrs[CANDIDATES_MAX];
+    int n;
+};
+
+/* Lookup of peername with the resolver on a thread of its own, so that
+ * discovery need not wait for it. Whoever of the thread and the caller is
+ * done with it last frees it. */
+struct lookup {
+    pthread_mutex_t lock;
+    int refs;
+    int pipefd[2];         /* a byte is written to pipefd[1] once done */
+    struct candidates found;
+    char name[PEERNAME_MAX + 1];
+};
+
+static void lookup_release(struct lookup *lk)
+{
+    int refs;
+
+    pthread_mutex_lock(&lk->lock);
+    refs = --lk->refs;
+    pthread_mutex_unlock(&lk->lock);
+
+    if (!refs) {
+        close(lk->pipefd[0]);
+        close(lk->pipefd[1]);
+        pthread_mutex_destroy(&lk->lock);
+        free(lk);
+    }
+}
+
+/* Order the addresses the resolver has sorted by preference so that the
+ * families alternate, as RFC 8305 recommends, and a family broken on the
+ * path does not hold the other one up. */
+static void interleave(struct candidates *c)
+{
+    struct candidates sorted;
+    int used[CANDIDATES_MAX];
+    int i, j, family = c->addrs[0].ss_family;
+
+    memset(used, '\0', sizeof used);
+    for (sorted.n = 0; sorted.n < c->n; family = (family == AF_INET6)
+                                                 ? AF_INET : AF_INET6) {
+        /* The next address of the family, or of any if none is left. */
+        for (j = -1, i = 0; i < c->n; i++) {
+            if (used[i])
+                continue;
+            if (c->addrs[i].ss_family == family) {
+                j = i;
+                break;
+            }
+            if (j < 0)
+                j = i;
+        }
+        used[j] = 1;
+        sorted.addrs[sorted.n++] = c->addrs[j];
+    }
+    *c = sorted;
+}
+
+static void *lookup_thread(void *arg)
+{
+    struct lookup *lk = arg;
+    struct addrinfo hints, *res, *ai;
+    struct candidates c;
+    int found = 0;
+
+    memset(&hints, '\0', sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    c.n = 0;
+
+    if (getaddrinfo(lk->name, NULL, &hints, &res) == 0) {
+        for (ai = res; ai && c.n < CANDIDATES_MAX; ai = ai->ai_next) {
+            if ((ai->ai_family == AF_INET || ai->ai_family == AF_INET6) &&
+                ai->ai_addrlen <= sizeof c.addrs[0]) {
+                memset(&c.addrs[c.n], '\0', sizeof c.addrs[0]);
+                memcpy(&c.addrs[c.n++], ai->ai_addr, ai->ai_addrlen);
+            }
+        }
+        freeaddrinfo(res);
+    }
+    if (c.n) {
+        interleave(&c);
+        found = 1;
+    }
+
+    pthread_mutex_lock(&lk->lock);
+    lk->found = c;
+    pthread_mutex_unlock(&lk->lock);
+
+    if (write(lk->pipefd[1], &found, 1) != 1)
+        err_errno("Cannot report DNS lookup");
+    lookup_release(lk);
+    return NULL;
+}
+
+/* Start looking peername up, return NULL if that cannot be done. */
+static struct lookup *lookup_start(const char *peername)
+{
+    struct lookup *lk = calloc(1, sizeof *lk);
+    sigset_t all, old;
+    pthread_t thread;
+    int rv;
+
+    if (!lk || strlen(peername) > PEERNAME_MAX || pipe(lk->pipefd) != 0) {
+        free(lk);
+        return NULL;
+    }
+    pthread_mutex_init(&lk->lock, NULL);
+    strcpy(lk->name, peername);
+    lk->refs = 2;
+
+    /* Signals must interrupt system calls of the main thread. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    rv = pthread_create(&thread, NULL, lookup_thread, lk);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rv != 0) {
+        close(lk->pipefd[0]);
+        close(lk->pipefd[1]);
+        pthread_mutex_destroy(&lk->lock);
+        free(lk);
+        return NULL;
+    }
+    pthread_detach(thread);
+    return lk;
+}
+
+/* Store the addresses of the completed lookup, return their number. */
+static int lookup_result(struct lookup *lk, struct candidates *c)
+{
+    pthread_mutex_lock(&lk->lock);
+    *c = lk->found;
+    pthread_mutex_unlock(&lk->lock);
+    return c->n;
+}
+
+/* Store addresses of the comma-separated list str, in the order given.
+ * Return their number, or 0 if any of them is not a numeric address. */
+static int parse_addr_list(const char *str, struct candidates *c)
+{
+    char addr[NI_MAXHOST];
+    size_t len;
+
+    for (c->n = 0; c->n < CANDIDATES_MAX; str += len + 1) {
+        len = strcspn(str, ",");
+        if (len >= sizeof addr)
+            break;
+        memcpy(addr, str, len);
+        addr[len] = '\0';
+        if (netaddr_parse(addr, &c->addrs[c->n]) != 0)
+            break;
+        c->n++;
+        if (!str[len])
+            return c->n;
+    }
+    c->n = 0;
+    return 0;
+}
+
+/* Check that the peer still answers to its name at the cached address. */
+static int probe_cached_peer(const char *peername,
+                             struct sockaddr_storage *addr,
+                             struct peer_status *st)
+{
+    struct sockaddr_storage cached;
+    struct discovery_socks ds;
+    int found;
+
+    if (!peercache_lookup(peername, &cached))
+        return 0;
+    netaddr_set_port(&cached, CATCH_PORT);
+
+    discovery_open(&ds);
+    found = discover_peer(&ds, peername, &cached,
+                          (discovery_timeout_ms < PROBE_TIMEOUT_MS)
+                              ? discovery_timeout_ms : PROBE_TIMEOUT_MS,
+                          -1, addr, st) == 1;
+    discovery_close(&ds);
+
+    if (!found && !terminate) {
+        info("Peer %s is no longer at %s", peername, netaddr_str(&cached));
+        peercache_forget(peername);
+    }
+    return found;
+}
+
+/* Store the addresses to try in c. Return 1 if the address has been taken
+ * from the peer cache, 0 otherwise. The cache is not used unless use_cache
+ * is set. */
+static int resolve_peername(const char *peername, struct candidates *c,
+                            int use_cache)
+{
+    struct discovery_socks ds;
+    struct lookup *lk = NULL;
+    struct peer_status st;
+    uint32_t start_ms, elapsed_ms;
+
+    /* What peers found otherwise than by discovery accept is unknown. */
+    peer_caps = 0;
+
+    /* Addresses need neither DNS nor discovery. */
+    if (parse_addr_list(peername, c))
+        return 0;
+
+    /* Peers discovered before are asked directly, so neither DNS nor
+     * broadcasts are waited for. */
+    if (use_cache &&
+        probe_cached_peer(peername + (peername[0] == '@'), &c->addrs[0],
+                          &st)) {
+        peer_caps = st.caps;
+        c->n = 1;
+        return 1;
+    }
+
+    /* Negative answers from DNS resolver can be annoyingly slow, so the
+     * lookup races broadcast discovery, and whichever finds the peer first
+     * wins. The at sign before peername avoids using DNS at all. */
+    if (peername[0] == '@')
+        peername++;
+    else
+        lk = lookup_start(peername);
+
+    discovery_open(&ds);
+
     info("Discovering peers...");
-    inp->s_addr = INADDR_NONE;
 
-    for (i = 0; i < 5 && !terminate; i++)
-        if (discover_peer(sockfd, peername, inp))
+    start_ms = clock_get_monotonic();
+    while (!terminate && !c->n &&
+           (elapsed_ms = clock_get_monotonic() - start_ms)
+               < discovery_timeout_ms) {
+        int rv = discover_peer(&ds, peername, NULL,
+                               discovery_timeout_ms - elapsed_ms,
+                               lk ? lk->pipefd[0] : -1, &c->addrs[0], &st);
+
+        if (rv == 1) {
+            peercache_store(peername, &c->addrs[0]);
+            peer_caps = st.caps;
+            c->n = 1;
+        } else if (rv == 0) {
             break;
+        } else {
+            /* DNS has answered before discovery, or failed to. */
+            if (lookup_result(lk, c))
+                info("Peer %s resolved to %s%s", peername,
+                     netaddr_str(&c->addrs[0]),
+                     (c->n > 1) ? " and more" : "");
+            lookup_release(lk);
+            lk = NULL;
+        }
+    }
 
-    close(sockfd);
+    discovery_close(&ds);
+    if (lk)
+        lookup_release(lk);
 
     if (terminate)
         die("Terminated");
-    if (inp->s_addr == INADDR_NONE)
+    if (!c->n)
         die("Peer %s wasn't located", peername);
+    return 0;
+}
+
+/* Every message is sent at once, only the content is sent with MSG_MORE,
+ * so Nagle's algorithm would just delay messages following it. */
+static void set_nodelay(int sockfd)
+{
+#ifdef MSG_MORE
+    int optval = 1;
+    (void)setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof optval);
+#else
+    UNUSED(sockfd);
+#endif
+}
+
+/* Start connecting to addr without waiting, return the socket or -1. */
+static int start_connect(const struct sockaddr_storage *addr)
+{
+    int sockfd = socket(addr->ss_family, SOCK_STREAM, IPPROTO_TCP);
+
+    if (sockfd < 0)
+        return -1;
+    if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK) != 0 ||
+        (connect(sockfd, (const struct sockaddr *)addr,
+                 netaddr_len(addr)) != 0 && errno != EINPROGRESS)) {
+        int saved_errno = errno;
+
+        close(sockfd);
+        errno = saved_errno;
+        return -1;
+    }
+    return sockfd;
+}
+
+/* Connect to the candidates the happy eyeballs way of RFC 8305: the next
+ * attempt starts whenever the previous ones have failed or have not
+ * succeeded in ATTEMPT_DELAY_MS, and the first connection established
+ * wins. Return its socket, or -1 with errno of the last failure. */
+static int connect_fastest(const struct candidates *c)
+{
+    struct pollfd pfds[CANDIDATES_MAX];
+    int started = 0, pending = 0, winner = -1;
+    int last_errno = ECONNREFUSED;
+    uint32_t next_ms = clock_get_monotonic();
+    int i;
+
+    while (winner < 0 && !terminate && (started < c->n || pending)) {
+        uint32_t now_ms = clock_get_monotonic();
+        int timeout = -1;
+
+        if (started < c->n && (!pending || (int32_t)(now_ms - next_ms) >= 0)) {
+            int fd;
+
+            if (c->n > 1)
+                info("Connecting to %s", netaddr_str(&c->addrs[started]));
+            fd = start_connect(&c->addrs[started]);
+
+            pfds[started].fd = fd;
+            pfds[started].events = POLLOUT;
+            pfds[started].revents = 0;
+            started++;
+            if (fd >= 0) {
+                pending++;
+                next_ms = now_ms + ATTEMPT_DELAY_MS;
+            } else {
+                last_errno = errno;
+            }
+            continue;
+        }
+        if (started < c->n)
+            timeout = next_ms - now_ms;
+
+        if (poll(pfds, started, timeout) < 0) {
+            if (errno != EINTR)
+                die_errno("poll()");
+            continue;
+        }
+
+        for (i = 0; i < started && winner < 0; i++) {
+            int error = 0;
+            socklen_t len = sizeof error;
+
+            if (pfds[i].fd < 0 || !pfds[i].revents)
+                continue;
+            if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &error,
+                           &len) != 0)
+                error = errno;
+            if (!error) {
+                winner = i;
+            } else {
+                last_errno = error;
+                close(pfds[i].fd);
+                pfds[i].fd = -1;
+                pending--;
+            }
+        }
+    }
+
+    for (i = 0; i < started; i++)
+        if (i != winner && pfds[i].fd >= 0)
+            close(pfds[i].fd);
+
+    if (winner < 0) {
+        errno = terminate ? EINTR : last_errno;
+        return -1;
+    }
+    if (c->n > 1)
+        info("Pushing to %s", netaddr_str(&c->addrs[winner]));
+    fcntl(pfds[winner].fd, F_SETFL,
+          fcntl(pfds[winner].fd, F_GETFL) & ~O_NONBLOCK);
+    return pfds[winner].fd;
+}
+
+/* Connect to the peer over TCP, discovering it again if it is not at its
+ * cached address any more. */
+static int connect_peer(const char *peername, unsigned long port)
+{
+    int use_cache = 1;
+
+    for (;;) {
+        struct candidates c;
+        int cached, sockfd, i;
+
+        cached = resolve_peername(peername, &c, use_cache);
+        for (i = 0; i < c.n; i++)
+            netaddr_set_port(&c.addrs[i], port);
+
+        if (c.n == 1)
+            info("Pushing to %s", netaddr_str(&c.addrs[0]));
+
+        sockfd = connect_fastest(&c);
+        if (sockfd >= 0)
+            return sockfd;
+        if (!cached || terminate)
+            die_errno("Cannot connect to remote host");
+
+        err_errno("Cannot connect to cached address of %s", peername);
+        peercache_forget(peername + (peername[0] == '@'));
+        use_cache = 0;
+    }
 }
 
 static off_t get_filelen_or_die(const char *pathname)
@@ -204,6 +759,15 @@ static off_t get_filelen_or_die(const char *pathname)
     return filelen;
 }
 
+static void print_stats(const struct xfer_stats *stats)
+{
+    char line[STATS_LINE_MAX];
+    int i;
+
+    for (i = 0; stats_format(stats, i, line, sizeof line) == 0; i++)
+        info("%s", line);
+}
+
 static void on_stage_change(const struct push_context *ctx, int stage)
 {
     switch (stage) {
@@ -220,6 +784,24 @@ static void on_stage_change(const struct push_context *ctx, int stage)
     }
 }
 
+/* Show progress of sending on the terminal, on a line of its own. */
+static void on_progress(const struct push_context *ctx, int stage)
+{
+    const struct progress *p = &ctx->progress;
+
+    if (stage != PUSH_SEND)
+        return;
+
+    fprintf(stderr, "\r%3d%% %7.1f MB/s", (p->total > 0) ?
+            (int)(100.0 * p->pos / p->total) : 100, p->rate / 1e6);
+    if (p->eta >= 0)
+        fprintf(stderr, "  ETA %lu:%02lu ", (unsigned long)p->eta / 60,
+                (unsigned long)p->eta % 60);
+    progress_shown = (p->pos < p->total);
+    if (!progress_shown)
+        fputc('\n', stderr);
+}
+
 static void die_push(const struct push_context *ctx, const char *msg)
 {
     err(msg);
@@ -231,27 +813,58 @@ static void die_push(const struct push_context *ctx, const char *msg)
     exit(EXIT_FAILURE);
 }
 
-static int push_file(int sockfd, const char *pathname)
+static int push_file(struct transport *tr, const char *pathname)
 {
     struct push_context ctx;
+    struct source src;
+    int fd;
+
+    memset(&ctx, '\0', sizeof ctx);
     ctx.terminate = &terminate;
-    ctx.sk = sockfd;
+    ctx.tr = tr;
     ctx.filename = basename(pathname);
     ctx.filelen = get_filelen_or_die(pathname);
     ctx.fileoff = 0;
-    ctx.calc_digest = 1;
+    ctx.calc_digest = calc_digest;
     ctx.forced = forced;
+    ctx.sparse = sparse || (peer_caps & DISCOVERY_CAP_SPARSE);
     ctx.on_stage_change = on_stage_change;
-    ctx.fp = fopen(pathname, "r");
-    if (!ctx.fp)
+    if (g_verbose && isatty(STDERR_FILENO))
+        ctx.on_progress = on_progress;
+    ctx.src = &src;
+    ctx.chunksize = chunksize;
+    ctx.chunkbuf = chunkbuf;
+    if (show_stats) {
+        stats_reset(&stats);
+        ctx.stats = &stats;
+    }
+
+    fd = open(pathname, O_RDONLY);
+    if (fd < 0)
         die_errno("Cannot open file %s", pathname);
 
+    /* Map the file to push it without copying, unless it cannot be mapped. */
+    if (mmap_source_init(&src, fd) != 0 && fd_source_init(&src, fd) != 0)
+        die_errno("Cannot read file %s", pathname);
+    src.size(&src, &ctx.filelen);
+
     info("Sending file %s (%llu bytes)", pathname,
          (unsigned long long)ctx.filelen);
 
     int rv = libpush_push_file(&ctx);
 
-    fclose(ctx.fp);
+    if (progress_shown) {
+        fputc('\n', stderr);
+        progress_shown = 0;
+    }
+
+    if (src.close)
+        src.close(&src);
+    close(fd);
+
+    /* As catch does, only transfers that completed are reported. */
+    if (show_stats && (rv == 0 || rv == RV_NACK))
+        print_stats(&stats);
 
     switch (rv) {
     case 0:
@@ -292,18 +905,80 @@ int main(int argc, const char *argv[])
     int ret = EXIT_SUCCESS;
     int i;
     int sockfd;
-    struct sockaddr_in sa;
-
-    if (argc > 1 && !strcmp(argv[1], "-f")) {
-        forced = 1;
+    struct transport tr;
+    size_t bufsize = 0;
+    unsigned long rate = TUNE_RATE;
+    unsigned long port = CATCH_PORT;
+
+    for (;;) {
+        if (argc > 1 && !strcmp(argv[1], "-f")) {
+            forced = 1;
+        } else if (argc > 1 && !strcmp(argv[1], "--stats")) {
+            show_stats = 1;
+        } else if (argc > 1 && !strcmp(argv[1], "--no-digest")) {
+            calc_digest = 0;
+        } else if (argc > 1 && !strcmp(argv[1], "--sparse")) {
+            sparse = 1;
+        } else if (argc > 2 && !strcmp(argv[1], "-b")) {
+            bufsize = parse_size(argv[2]);
+            argc--;
+            argv++;
+        } else if (argc > 2 && !strcmp(argv[1], "-r")) {
+            rate = parse_size(argv[2]);
+            argc--;
+            argv++;
+        } else if (argc > 2 && !strcmp(argv[1], "-t")) {
+            char *end;
+            double secs = strtod(argv[2], &end);
+
+            if (*end || end == argv[2] || !(secs > 0) || secs > 3600)
+                die("Invalid discovery timeout %s", argv[2]);
+            discovery_timeout_ms = (uint32_t)(secs * 1000 + 0.5);
+            if (!discovery_timeout_ms)
+                discovery_timeout_ms = 1;
+            argc--;
+            argv++;
+        } else if (argc > 2 && !strcmp(argv[1], "-p")) {
+            char *end;
+
+            port = strtoul(argv[2], &end, 10);
+            if (*end || !port || port > 65535)
+                die("Invalid port %s", argv[2]);
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
         argc--;
         argv++;
     }
 
     if (argc < 3) {
-        puts("usage: push [-f] [@]peername files...\n");
+        puts("usage: push [-f] [-b bufsize] [-r mbits] [-p port] [-t secs]\n"
+             "            [--stats] [--no-digest] [--sparse] [@]peername "
+             "files...\n");
         puts("The optional at sign (@) in front of peername can be used");
-        puts("to force broadcast peer discovery avoiding use of DNS resolver.\n");
+        puts("to force broadcast peer discovery avoiding use of DNS resolver.");
+        puts("Discovery gives up after 5 seconds, or secs given by -t.");
+        puts("Peers found by discovery are cached for a day in the file");
+        puts("$PUSH_PEER_CACHE (or ~/.cache/push-peers), so the next push");
+        puts("asks them directly.");
+        puts("Peername may also be a comma-separated list of addresses,");
+        puts("tried in the order given as addresses of a name are.");
+        puts("Peername unix:PATH refers to catch -u PATH on the same host,");
+        puts("which then copies the files directly.\n");
+        puts("Socket send buffer is sized for a link of 1000 Mbit/s (or");
+        puts("mbits given by -r) with the measured round-trip time, unless");
+        puts("its size is given by -b.\n");
+        puts("Option -p connects to another port than 2121, where a proxy");
+        puts("forwarding to catch may listen.\n");
+        puts("Option --stats shows time spent reading, hashing, sending");
+        puts("and writing of each file, and resources used in total.\n");
+        puts("Option --no-digest leaves transfers unverified, so catch");
+        puts("must be run with it too.\n");
+        puts("Holes of sparse files are left out only for catches that");
+        puts("tell in discovery that they fill them in, or for any catch");
+        puts("with --sparse. Older catches need the holes sent.\n");
         puts("BEWARE! This program pushes files carelessly and absolutely");
         puts("unencrypted. DO NOT USE IT IF YOU CAN.");
         exit(EXIT_FAILURE);
@@ -315,23 +990,33 @@ int main(int argc, const char *argv[])
     sigaction(SIGINT, &sigact, NULL);
     sigaction(SIGTERM, &sigact, NULL);
 
-    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (sockfd < 0)
-        die_errno("Cannot create TCP socket");
+    if (!strncmp(argv[1], UNIX_PEER_PREFIX, strlen(UNIX_PEER_PREFIX))) {
+        const char *path = argv[1] + strlen(UNIX_PEER_PREFIX);
 
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(CATCH_PORT);
-    resolve_peername(argv[1], &sa.sin_addr);
-
-    info("Pushing to %s", inet_ntoa(sa.sin_addr));
+        info("Pushing to %s", path);
+        sockfd = unix_connect(path);
+        if (sockfd < 0)
+            die_errno("Cannot connect to %s", path);
+        unix_transport_init(&tr, sockfd);
+    } else {
+        sockfd = connect_peer(argv[1], port);
+        set_nodelay(sockfd);
+        sock_transport_init(&tr, sockfd);
+    }
 
-    if (connect(sockfd, (struct sockaddr *)&sa, sizeof sa) != 0)
-        die_errno("Cannot connect to remote host");
+    chunksize = tune_socket(sockfd, SO_SNDBUF, bufsize, rate);
+    chunkbuf = malloc(chunksize);
+    if (!chunkbuf)
+        die("Cannot allocate %lu bytes", (unsigned long)chunksize);
 
     for (i = 2; i < argc && !terminate; i++)
-        if (push_file(sockfd, argv[i]) != 0)
+        if (push_file(&tr, argv[i]) != 0)
             ret = EXIT_FAILURE;
 
+    free(chunkbuf);
     close(sockfd);
+    if (show_stats)
+        print_rusage();
+
     return ret;
 }
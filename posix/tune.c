@@ -0,0 +1,99 @@
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "tune.h"
+
+/* Smoothed round-trip time of a TCP connection in microseconds, which is
+ * known right after the handshake, or 0 if unknown. */
+static unsigned long rtt_usec(int sockfd)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+    struct tcp_info ti;
+    socklen_t len = sizeof ti;
+
+    if (getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0)
+        return ti.tcpi_rtt;
+#else
+    UNUSED(sockfd);
+#endif
+    return 0;
+}
+
+size_t tune_socket(int sockfd, int optname, size_t bufsize, unsigned long rate)
+{
+    unsigned long rtt = rtt_usec(sockfd);
+    int cursize = 0;
+    socklen_t len = sizeof cursize;
+    size_t chunk;
+
+    (void)getsockopt(sockfd, SOL_SOCKET, optname, &cursize, &len);
+
+    if (!bufsize) {
+        /* Mbit/s times us makes bits. */
+        double bdp = (double)rate * rtt / 8;
+        if (bdp > TUNE_BUF_MAX)
+            bdp = TUNE_BUF_MAX;
+        if (bdp > cursize)
+            bufsize = bdp;
+    }
+
+    if (bufsize) {
+        int size = (bufsize > INT_MAX) ? INT_MAX : (int)bufsize;
+        if (setsockopt(sockfd, SOL_SOCKET, optname, &size, sizeof size) != 0)
+            err_errno("Cannot set socket buffer size to %d", size);
+        len = sizeof cursize;
+        (void)getsockopt(sockfd, SOL_SOCKET, optname, &cursize, &len);
+    }
+
+    chunk = (cursize > 0) ? (size_t)cursize : 0;
+    if (chunk < TUNE_CHUNK_MIN)
+        chunk = TUNE_CHUNK_MIN;
+    else if (chunk > TUNE_CHUNK_MAX)
+        chunk = TUNE_CHUNK_MAX;
+
+    info("RTT %lu us, %s buffer %d bytes%s, chunks of %lu bytes", rtt,
+         (optname == SO_SNDBUF) ? "send" : "receive", cursize,
+         bufsize ? "" : " (system default)", (unsigned long)chunk);
+    return chunk;
+}
+
+size_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long size;
+
+    errno = 0;
+    size = strtoul(str, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    }
+    if (errno || end == str || *end)
+        die("Invalid size %s", str);
+    return size;
+}
+
+void print_rusage(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        err_errno("Cannot get resource usage");
+        return;
+    }
+    /* Linux reports the peak in kilobytes, the BSDs do too. */
+    info("Used CPU %.3f s, peak RSS %ld KiB",
+         ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6,
+         ru.ru_maxrss);
+}
@@ -0,0 +1,25 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stddef.h>
+
+#define TUNE_RATE 1000          /* Mbit/s the autotuning counts on */
+#define TUNE_BUF_MAX (64 << 20) /* biggest socket buffer autotuning sets */
+#define TUNE_CHUNK_MIN 32768
+#define TUNE_CHUNK_MAX (1 << 20)
+
+/* Size the send (optname SO_SNDBUF) or receive (SO_RCVBUF) buffer of
+ * a connected socket. Unless bufsize is given explicitly, the buffer is
+ * sized to the bandwidth-delay product of rate (in Mbit/s) and round-trip
+ * time measured by the system, if that is bigger than the current size.
+ * The outcome is logged. Returns the size of chunks of content to transfer
+ * at once, which fill the buffer. */
+size_t tune_socket(int sockfd, int optname, size_t bufsize, unsigned long rate);
+
+/* Parse size given in bytes or with suffix k or m, or die. */
+size_t parse_size(const char *str);
+
+/* Log CPU time and peak resident set size of the process with info(). */
+void print_rusage(void);
+
+#endif
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "unixsock.h"
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+/* Control message buffer for a single descriptor, properly aligned. */
+union fd_cmsg {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+};
+
+static int unix_sendv(struct transport *tr, const struct tr_iovec *iov,
+                      int iovcnt, int more, size_t *nsent)
+{
+    struct msghdr msg;
+    struct iovec vec[TR_IOVMAX];
+    struct cmsghdr *cmsg;
+    union fd_cmsg control;
+    ssize_t n;
+    int i;
+
+    /* There is no Nagle's algorithm to keep data back from. */
+    UNUSED(more);
+
+    if (tr->fd_out < 0)
+        return send_somev(tr->sk, iov, iovcnt, 0, nsent);
+
+    memset(&msg, '\0', sizeof msg);
+    memset(&control, '\0', sizeof control);
+    for (i = 0; i < iovcnt && i < TR_IOVMAX; i++) {
+        vec[i].iov_base = (void *)iov[i].base;
+        vec[i].iov_len = iov[i].len;
+    }
+    msg.msg_iov = vec;
+    msg.msg_iovlen = i;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &tr->fd_out, sizeof(int));
+
+    *nsent = 0;
+    n = sendmsg(tr->sk, &msg, MSG_NOSIGNAL);
+    if (n > 0) {
+        /* The descriptor went along with the first byte. */
+        *nsent = n;
+        tr->fd_out = -1;
+    } else if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return RV_WOULDBLOCK;
+        else if (errno == EPIPE || errno == ECONNRESET)
+            return RV_CONNCLOSED;
+        else if (errno != EINTR)
+            return RV_NETIOERROR;
+    }
+    return 0;
+}
+
+static int unix_send(struct transport *tr, const void *buf, size_t len,
+                     size_t *nsent)
+{
+    struct tr_iovec iov;
+
+    iov.base = buf;
+    iov.len = len;
+    return unix_sendv(tr, &iov, 1, 0, nsent);
+}
+
+static int unix_recv(struct transport *tr, void *buf, size_t len,
+                     size_t *nreceived)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union fd_cmsg control;
+    ssize_t n;
+
+    memset(&msg, '\0', sizeof msg);
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+
+    *nreceived = 0;
+    n = recvmsg(tr->sk, &msg, MSG_CMSG_CLOEXEC);
+    if (n > 0) {
+        *nreceived = n;
+    } else if (n == 0) {
+        /* Peer closed the connection. */
+        return RV_CONNCLOSED;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return RV_WOULDBLOCK;
+    } else if (errno != EINTR) {
+        return RV_NETIOERROR;
+    }
+
+    /* Descriptors that did not fit the buffer are closed by the kernel. */
+    for (cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) {
+            if (tr->fd_in >= 0)
+                close(tr->fd_in);
+            memcpy(&tr->fd_in, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    return 0;
+}
+
+static int unix_pass_fd(struct transport *tr, int fd)
+{
+    tr->fd_out = fd;
+    return 0;
+}
+
+static int unix_passed_fd(struct transport *tr)
+{
+    if (tr->fd_taken >= 0)
+        close(tr->fd_taken);
+    tr->fd_taken = tr->fd_in;
+    tr->fd_in = -1;
+    return tr->fd_taken;
+}
+
+void unix_transport_init(struct transport *tr, int sk)
+{
+    sock_transport_init(tr, sk);
+    tr->send = unix_send;
+    tr->recv = unix_recv;
+    tr->sendv = unix_sendv;
+    tr->pass_fd = unix_pass_fd;
+    tr->passed_fd = unix_passed_fd;
+}
+
+void unix_transport_free(struct transport *tr)
+{
+    if (tr->fd_in >= 0)
+        close(tr->fd_in);
+    if (tr->fd_taken >= 0)
+        close(tr->fd_taken);
+    tr->fd_in = -1;
+    tr->fd_taken = -1;
+}
+
+/* Create a socket and fill in the address of path. */
+static int unix_socket(const char *path, struct sockaddr_un *sa_un)
+{
+    if (strlen(path) >= sizeof sa_un->sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(sa_un, '\0', sizeof *sa_un);
+    sa_un->sun_family = AF_UNIX;
+    strcpy(sa_un->sun_path, path);
+
+    return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+int unix_listen(const char *path, int backlog)
+{
+    struct sockaddr_un sa_un;
+    struct stat sb;
+    int fd = unix_socket(path, &sa_un);
+
+    if (fd < 0)
+        return -1;
+
+    /* Socket left behind by a killed process would make bind() fail. */
+    if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+        (void)unlink(path);
+
+    if (bind(fd, (struct sockaddr *)&sa_un, sizeof sa_un) != 0 ||
+        listen(fd, backlog) != 0) {
+        int saved_errno = errno;
+
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+int unix_connect(const char *path)
+{
+    struct sockaddr_un sa_un;
+    int fd = unix_socket(path, &sa_un);
+
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)&sa_un, sizeof sa_un) != 0) {
+        int saved_errno = errno;
+
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
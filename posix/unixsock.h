@@ -0,0 +1,23 @@
+#ifndef UNIXSOCK_H
+#define UNIXSOCK_H
+
+#include "transport.h"
+
+/* Peernames starting with this prefix are paths of UNIX domain sockets. */
+#define UNIX_PEER_PREFIX "unix:"
+
+/* Initialize transport over a connected UNIX domain stream socket, which
+ * is able to pass file descriptors. */
+void unix_transport_init(struct transport *tr, int sk);
+
+/* Close descriptors received over the transport, but not its socket. */
+void unix_transport_free(struct transport *tr);
+
+/* Return a stream socket listening at path with the backlog, replacing a
+ * socket left there, or -1 with errno set. */
+int unix_listen(const char *path, int backlog);
+
+/* Return a stream socket connected to path, or -1 with errno set. */
+int unix_connect(const char *path);
+
+#endif
@@ -0,0 +1,39 @@
+#include "common.h"
+#include "progress.h"
+
+void progress_start(struct progress *p, off_t pos, off_t total)
+{
+    get_clocks(&p->start, NULL);
+    p->last = p->start;
+    p->start_pos = p->last_pos = p->pos = pos;
+    p->total = total;
+    p->elapsed = p->rate = p->avg_rate = 0;
+    p->eta = -1;
+}
+
+int progress_update(struct progress *p, off_t pos)
+{
+    double now, secs = p->secs_interval;
+    int due;
+
+    if (!p->bytes_interval && secs <= 0)
+        secs = PROGRESS_SECS;
+
+    p->pos = pos;
+    due = (pos >= p->total && pos > p->last_pos) ||
+          (p->bytes_interval && pos - p->last_pos >= p->bytes_interval);
+    if (!due && secs <= 0)
+        return 0;
+
+    get_clocks(&now, NULL);
+    if (!due && now - p->last < secs)
+        return 0;
+
+    p->elapsed = now - p->start;
+    p->rate = (now > p->last) ? (pos - p->last_pos) / (now - p->last) : 0;
+    p->avg_rate = (p->elapsed > 0) ? (pos - p->start_pos) / p->elapsed : 0;
+    p->eta = (p->avg_rate > 0) ? (p->total - pos) / p->avg_rate : -1;
+    p->last = now;
+    p->last_pos = pos;
+    return 1;
+}
@@ -0,0 +1,37 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include "platform.h"
+
+#define PROGRESS_SECS 0.5 /* interval of reports unless set otherwise */
+
+/* Progress of a stage of a transfer, as reported to on_progress() callbacks
+ * of libpush and libcatch. They are called once bytes_interval bytes have
+ * been processed or secs_interval seconds have passed since the previous
+ * report, whichever comes first, and once the stage completes. If neither
+ * interval is set, reports come every PROGRESS_SECS seconds. */
+struct progress {
+    off_t bytes_interval;  /* set by the application */
+    double secs_interval;
+
+    off_t pos;             /* bytes processed by the stage so far */
+    off_t total;           /* of bytes the stage has to process */
+    double elapsed;        /* seconds since start of the stage */
+    double rate;           /* bytes per second since the previous report */
+    double avg_rate;       /* and since start of the stage */
+    double eta;            /* seconds left at the average rate or -1 */
+
+    /* Private state of the reports. */
+    off_t start_pos;
+    off_t last_pos;
+    double start;
+    double last;
+};
+
+/* Start reports of a stage getting from pos to total. */
+void progress_start(struct progress *p, off_t pos, off_t total);
+
+/* Update the position, return nonzero if a report is due. */
+int progress_update(struct progress *p, off_t pos);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef RETVAL_H
+#define RETVAL_H
+
+/* Return values of the library functions. Zero means success. */
+
+#define RV_TERMINATED 1
+#define RV_NACK       3
+#define RV_REJECT     4
+#define RV_UNEXPECTED 5
+#define RV_IOERROR    6
+#define RV_NETIOERROR 7
+#define RV_CONNCLOSED 8
+#define RV_RESUME_ACK 9
+#define RV_RESUME_NACK 10
+#define RV_LOCAL_BIGGER 12
+#define RV_NOENT 13
+#define RV_NOT_REGULAR_FILE 14
+#define RV_TOOBIG 15
+#define RV_DIGEST_MATCH 16
+#define RV_SIZE_MATCH 17
+#define RV_COMPLETED_DIGEST_MISMATCH 18
+#define RV_OFFSET 19
+#define RV_WOULDBLOCK 20
+
+#endif
@@ -5,14 +5,15 @@
 #include <stdio.h>
 
 #define SHA1_LEN 20
+#define SHA1_STR_SIZE (SHA1_LEN*2 + 1)
 
 struct sha1 {
     uint8_t value[SHA1_LEN];
 };
 
-static inline char *sha1_str(const struct sha1 *hash)
+/* Format the hash as a hex string into buf of at least SHA1_STR_SIZE. */
+static inline char *sha1_str(const struct sha1 *hash, char *buf)
 {
-    static char buf[SHA1_LEN*2 + 1];
     char *out = buf;
     size_t i;
     for (i = 0; i < SHA1_LEN; i++)
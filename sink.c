@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "sink.h"
+
+#define MEM_ALLOC_MIN 65536 /* first buffer of memory sink */
+
+static int stdio_stat(struct sink *sink, const char *name, off_t *len)
+{
+    UNUSED(sink);
+    return get_filelen(name, len);
+}
+
+static int stdio_open(struct sink *sink, const char *name, int create,
+                      off_t len)
+{
+    UNUSED(len);
+
+    /* b in mode is important for Windows. */
+    sink->fp = fopen(name, create ? "wb" : "rb+");
+    sink->pos = 0;
+    sink->writing = 0;
+    return sink->fp ? 0 : RV_IOERROR;
+}
+
+/* Get the stream to offset off. C standard requires a call to a file
+ * position function when switching between reading and writing, unless
+ * this is done, fwrite() fails at least on Windows. */
+static int stdio_seek(struct sink *sink, off_t off, int writing)
+{
+    if (off != sink->pos) {
+        if (fseek(sink->fp, (long)off, SEEK_SET) != 0)
+            return RV_IOERROR;
+        sink->pos = off;
+    } else if (writing != sink->writing) {
+        if (fseek(sink->fp, 0L, SEEK_CUR) != 0)
+            return RV_IOERROR;
+    }
+    sink->writing = writing;
+    return 0;
+}
+
+static int stdio_write_at(struct sink *sink, off_t off, const void *buf,
+                          size_t len)
+{
+    if (stdio_seek(sink, off, 1) != 0 || fwrite(buf, 1, len, sink->fp) != len)
+        return RV_IOERROR;
+
+    sink->pos += len;
+    return 0;
+}
+
+static int stdio_read_at(struct sink *sink, off_t off, void *buf, size_t len)
+{
+    if (stdio_seek(sink, off, 0) != 0 || fread(buf, 1, len, sink->fp) != len)
+        return RV_IOERROR;
+
+    sink->pos += len;
+    return 0;
+}
+
+static int stdio_finalize(struct sink *sink, int rv)
+{
+    UNUSED(rv);
+    rv = fclose(sink->fp);
+    sink->fp = NULL;
+    return (rv == 0) ? 0 : RV_IOERROR;
+}
+
+void stdio_sink_init(struct sink *sink)
+{
+    memset(sink, '\0', sizeof *sink);
+    sink->stat = stdio_stat;
+    sink->open = stdio_open;
+    sink->write_at = stdio_write_at;
+    sink->read_at = stdio_read_at;
+    sink->finalize = stdio_finalize;
+    sink->fd = -1;
+    sink->dirfd = -1;
+}
+
+static int mem_stat(struct sink *sink, const char *name, off_t *len)
+{
+    UNUSED(sink);
+    UNUSED(name);
+    UNUSED(len);
+    return RV_NOENT;
+}
+
+static int mem_open(struct sink *sink, const char *name, int create,
+                    off_t len)
+{
+    UNUSED(name);
+    UNUSED(create);
+
+    if ((off_t)(size_t)len != len || (sink->maxlen && len > sink->maxlen))
+        return RV_TOOBIG;
+
+    sink->len = 0;
+    sink->cap = len;
+    return 0;
+}
+
+/* The buffer doubles, but never beyond the length of the file, so a peer
+ * announcing more than it sends does not get it allocated. */
+static int mem_write_at(struct sink *sink, off_t off, const void *buf,
+                        size_t len)
+{
+    if (off > sink->cap || (off_t)len > sink->cap - off)
+        return RV_IOERROR;
+
+    if (off + (off_t)len > sink->alloc) {
+        off_t alloc = sink->alloc ? sink->alloc : MEM_ALLOC_MIN;
+        unsigned char *data;
+
+        while (alloc < off + (off_t)len)
+            alloc *= 2;
+        if (alloc > sink->cap)
+            alloc = sink->cap;
+        data = realloc(sink->data, alloc);
+        if (!data)
+            return RV_IOERROR;
+        sink->data = data;
+        sink->alloc = alloc;
+    }
+
+    memcpy(sink->data + off, buf, len);
+    if (off + (off_t)len > sink->len)
+        sink->len = off + len;
+    return 0;
+}
+
+static int mem_read_at(struct sink *sink, off_t off, void *buf, size_t len)
+{
+    if (off > sink->len || (off_t)len > sink->len - off)
+        return RV_IOERROR;
+
+    memcpy(buf, sink->data + off, len);
+    return 0;
+}
+
+static int mem_finalize(struct sink *sink, int rv)
+{
+    UNUSED(sink);
+    UNUSED(rv);
+    return 0;
+}
+
+void mem_sink_init(struct sink *sink)
+{
+    memset(sink, '\0', sizeof *sink);
+    sink->stat = mem_stat;
+    sink->open = mem_open;
+    sink->write_at = mem_write_at;
+    sink->read_at = mem_read_at;
+    sink->finalize = mem_finalize;
+    sink->fd = -1;
+    sink->dirfd = -1;
+}
+
+void mem_sink_free(struct sink *sink)
+{
+    free(sink->data);
+    sink->data = NULL;
+    sink->len = sink->cap = sink->alloc = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include "platform.h"
+#include "retval.h"
+#include <stdio.h>
+
+/* Destination of caught files.
+ *
+ * stat() stores size of an existing file and returns 0, or returns
+ * RV_NOENT, RV_NOT_REGULAR_FILE or RV_IOERROR. open() opens the file
+ * expected to become len bytes long, truncating it if create is set,
+ * and returns 0, RV_TOOBIG if the sink cannot take len bytes or
+ * RV_IOERROR. write_at() and read_at() transfer exactly
+ * len bytes at offset off and return 0 or RV_IOERROR. finalize() is called
+ * once the transfer ends with its result rv (the file stays open
+ * otherwise) and returns 0 or RV_IOERROR. copy_from() is optional: if
+ * provided, it copies len bytes at offset off of open file fd to the same
+ * offset of the file and returns 0 or RV_IOERROR. zero() is optional too: if
+ * provided, it makes len bytes at offset off read as zeros, extending the
+ * file if needed and preferably without allocating space for them, and
+ * returns 0 or RV_IOERROR. Otherwise, zeros are written with write_at(). */
+struct sink {
+    int (*stat)(struct sink *sink, const char *name, off_t *len);
+    int (*open)(struct sink *sink, const char *name, int create, off_t len);
+    int (*write_at)(struct sink *sink, off_t off, const void *buf, size_t len);
+    int (*read_at)(struct sink *sink, off_t off, void *buf, size_t len);
+    int (*finalize)(struct sink *sink, int rv);
+    int (*copy_from)(struct sink *sink, off_t off, int fd, size_t len);
+    int (*zero)(struct sink *sink, off_t off, off_t len);
+    FILE *fp;            /* stdio sink */
+    int fd;              /* file descriptor sinks */
+    int dirfd;           /* directory of file descriptor sinks */
+    unsigned char *data; /* memory and mapped sinks */
+    off_t len;           /* size of data */
+    off_t cap;           /* size data may grow to */
+    off_t alloc;         /* bytes of data backed by memory or disk space */
+    off_t maxlen;        /* most bytes memory sink takes, 0 for any */
+    off_t pos;           /* current position of stdio sink */
+    int writing;         /* stdio sink is writing rather than reading */
+    void *priv;          /* private data of other sinks */
+};
+
+/* Sink creating files in the current directory with stdio. */
+void stdio_sink_init(struct sink *sink);
+
+/* Sink receiving files into a buffer in memory, which is reused for
+ * consecutive files, so no file exists in it beforehand. The buffer grows
+ * as content arrives rather than to the length the peer announces, and
+ * files longer than sink->maxlen (if set) are refused with RV_TOOBIG.
+ * Once a file is finalized, its content is available as sink->data of
+ * sink->len bytes until the next file is opened. */
+void mem_sink_init(struct sink *sink);
+
+/* Free the buffer of memory sink. */
+void mem_sink_free(struct sink *sink);
+
+#endif
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "source.h"
+
+static int source_size(struct source *src, off_t *size)
+{
+    *size = src->len;
+    return 0;
+}
+
+static int stdio_read_at(struct source *src, off_t off, void *buf, size_t len)
+{
+    /* Reads are sequential most of the time, so avoid seeking then. */
+    if (off != src->pos) {
+        if (fseek(src->fp, (long)off, SEEK_SET) != 0)
+            return RV_IOERROR;
+        src->pos = off;
+    }
+
+    if (fread(buf, 1, len, src->fp) != len)
+        return RV_IOERROR;
+
+    src->pos += len;
+    return 0;
+}
+
+void stdio_source_init(struct source *src, FILE *fp, off_t len)
+{
+    memset(src, '\0', sizeof *src);
+    src->read_at = stdio_read_at;
+    src->size = source_size;
+    src->fp = fp;
+    src->fd = -1;
+    src->len = len;
+}
+
+static int mem_read_at(struct source *src, off_t off, void *buf, size_t len)
+{
+    if (off > src->len || (off_t)len > src->len - off)
+        return RV_IOERROR;
+
+    memcpy(buf, src->data + off, len);
+    return 0;
+}
+
+static const void *mem_map(struct source *src, off_t off, size_t len)
+{
+    if (off > src->len || (off_t)len > src->len - off)
+        return NULL;
+
+    return src->data + off;
+}
+
+void mem_source_init(struct source *src, const void *data, off_t len)
+{
+    memset(src, '\0', sizeof *src);
+    src->read_at = mem_read_at;
+    src->size = source_size;
+    src->map = mem_map;
+    src->fd = -1;
+    src->data = data;
+    src->len = len;
+}
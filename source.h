@@ -0,0 +1,40 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include "platform.h"
+#include "retval.h"
+#include <stdio.h>
+
+/* Content being pushed.
+ *
+ * read_at() reads exactly len bytes at offset off and returns 0
+ * or RV_IOERROR. size() stores size of the content and returns 0 or an
+ * error number. map() is optional: if provided, it may return address
+ * of len bytes at offset off, which stay valid until the source is closed,
+ * or NULL, in which case read_at() is used. find_data() is optional too: if
+ * provided, it stores in *start and *end bounds of the first extent of data
+ * at or after offset off, which may follow a hole reading as zeros (both are
+ * the size if only a hole follows), and returns 0 or RV_IOERROR. close()
+ * releases resources acquired by the source, but not the stream or file it
+ * was made of. */
+struct source {
+    int (*read_at)(struct source *src, off_t off, void *buf, size_t len);
+    int (*size)(struct source *src, off_t *size);
+    const void *(*map)(struct source *src, off_t off, size_t len);
+    int (*find_data)(struct source *src, off_t off, off_t *start, off_t *end);
+    void (*close)(struct source *src);
+    FILE *fp;                  /* stdio source */
+    int fd;                    /* file descriptor sources */
+    const unsigned char *data; /* memory and mapped sources */
+    off_t len;                 /* size of the content */
+    off_t pos;                 /* current position of stdio source */
+    void *priv;                /* private data of other sources */
+};
+
+/* Source reading len bytes from stream fp opened in binary mode. */
+void stdio_source_init(struct source *src, FILE *fp, off_t len);
+
+/* Source of len bytes in memory. */
+void mem_source_init(struct source *src, const void *data, off_t len);
+
+#endif
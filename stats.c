@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "stats.h"
+
+static const char *const stage_names[STATS_STAGES] = {
+    "read", "hash", "net", "write"
+};
+
+void stats_reset(struct xfer_stats *stats)
+{
+    memset(stats, '\0', sizeof *stats);
+    get_clocks(&stats->wall, &stats->cpu);
+}
+
+void stats_start(const struct xfer_stats *stats, struct stats_mark *mark)
+{
+    if (stats)
+        get_clocks(&mark->wall, &mark->cpu);
+}
+
+void stats_add(struct xfer_stats *stats, int stage,
+               const struct stats_mark *mark, size_t bytes)
+{
+    struct stage_stats *st;
+    double wall, cpu;
+
+    if (!stats)
+        return;
+
+    get_clocks(&wall, &cpu);
+    st = &stats->stage[stage];
+    st->wall += wall - mark->wall;
+    st->cpu += cpu - mark->cpu;
+    st->bytes += bytes;
+    st->calls++;
+}
+
+int stats_format(const struct xfer_stats *stats, int i, char *buf,
+                 size_t size)
+{
+    int stage;
+
+    if (i == 0) {
+        double wall, cpu;
+
+        get_clocks(&wall, &cpu);
+        snprintf(buf, size, "Total %.3f s, CPU %.3f s",
+                 wall - stats->wall, cpu - stats->cpu);
+        return 0;
+    }
+
+    for (stage = 0; stage < STATS_STAGES; stage++) {
+        const struct stage_stats *st = &stats->stage[stage];
+        double mbytes = st->bytes / 1048576.0;
+
+        if (!st->calls || --i > 0)
+            continue;
+        snprintf(buf, size, "  %-5s %10.1f MiB in %8lu calls, %8.3f s "
+                 "(%8.1f MiB/s), CPU %.3f s", stage_names[stage], mbytes,
+                 st->calls, st->wall,
+                 (st->wall > 0) ? mbytes / st->wall : 0.0, st->cpu);
+        return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,60 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "platform.h"
+
+/* Stages of transfers accounted separately. */
+enum stats_stage {
+    STATS_READ,   /* reading content from the source or the sink */
+    STATS_HASH,   /* calculating digests */
+    STATS_NET,    /* sending and receiving */
+    STATS_WRITE,  /* writing content to the sink */
+    STATS_STAGES
+};
+
+/* Time in seconds spent in a stage, of which the calling thread has been
+ * running for cpu, bytes processed and number of calls (system calls for
+ * IO) made. */
+struct stage_stats {
+    double wall;
+    double cpu;
+    off_t bytes;
+    unsigned long calls;
+};
+
+/* Counters accumulated by transfers since stats_reset(). */
+struct xfer_stats {
+    struct stage_stats stage[STATS_STAGES];
+    double wall;  /* clocks at the reset */
+    double cpu;
+};
+
+/* Clocks at the start of a call. */
+struct stats_mark {
+    double wall;
+    double cpu;
+};
+
+void stats_reset(struct xfer_stats *stats);
+
+/* Account a call of the stage processing bytes, which started at mark
+ * taken by stats_start(). Both do nothing if stats is NULL. */
+void stats_start(const struct xfer_stats *stats, struct stats_mark *mark);
+void stats_add(struct xfer_stats *stats, int stage,
+               const struct stats_mark *mark, size_t bytes);
+
+#define STATS_LINE_MAX 128
+
+/* Format line i of the report on throughput of the stages since the reset
+ * into buf of size bytes, the totals first and then each stage entered.
+ * Return 0, or -1 if the report has fewer lines. */
+int stats_format(const struct xfer_stats *stats, int i, char *buf,
+                 size_t size);
+
+/* The application must provide the following as a function. */
+
+/* Store monotonic time and CPU time of the calling thread in seconds,
+ * the latter unless cpu is NULL. */
+/* void get_clocks(double *wall, double *cpu); */
+
+#endif
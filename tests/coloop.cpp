@@ -0,0 +1,104 @@
+/* Harness pushing and catching with the C++20 interface of libfpp.hpp, all
+ * sessions on one executor over socketpairs: FILE is pushed by descriptor
+ * into directory DIR, and content generated in memory is caught into
+ * memory at the same time. The content caught in memory is checked here,
+ * the file is left to the caller to compare. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "libfpp.hpp"
+
+extern "C" {
+#include "common.h"
+}
+
+namespace {
+
+constexpr std::size_t MEM_SIZE = 1 << 20; /* more than sockets buffer */
+
+fpp::Task<int> store(fpp::Task<int> task, int &rv)
+{
+    rv = co_await task;
+    co_return rv;
+}
+
+void socketpair_or_die(int sv[2])
+{
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        std::perror("socketpair");
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        std::puts("usage: coloop FILE DIR\n");
+        std::puts("Push FILE into directory DIR and content in memory into");
+        std::puts("memory on one executor of libfpp.hpp.");
+        return EXIT_FAILURE;
+    }
+
+    int filefd = open(argv[1], O_RDONLY);
+    int dirfd = open(argv[2], O_RDONLY | O_DIRECTORY);
+    if (filefd < 0 || dirfd < 0) {
+        std::perror(filefd < 0 ? argv[1] : argv[2]);
+        return EXIT_FAILURE;
+    }
+    const char *name = std::strrchr(argv[1], '/');
+    name = name ? name + 1 : argv[1];
+
+    std::vector<unsigned char> content(MEM_SIZE);
+    for (std::size_t i = 0; i < content.size(); i++)
+        content[i] = static_cast<unsigned char>(i * 2654435761u >> 13);
+
+    int file_sv[2], mem_sv[2];
+    socketpair_or_die(file_sv);
+    socketpair_or_die(mem_sv);
+
+    int file_push_rv = -1, file_catch_rv = -1;
+    int mem_push_rv = -1, mem_catch_rv = -1;
+    try {
+        fpp::Executor ex;
+        fpp::PushSession file_push(file_sv[0], name, filefd);
+        fpp::CatchSession file_catch(file_sv[1], dirfd);
+        fpp::PushSession mem_push(mem_sv[0], "mem",
+                                  std::as_bytes(std::span(content)));
+        fpp::CatchSession mem_catch(mem_sv[1]);
+
+        ex.spawn(store(file_catch.run(ex), file_catch_rv));
+        ex.spawn(store(mem_catch.run(ex), mem_catch_rv));
+        ex.spawn(store(file_push.run(ex), file_push_rv));
+        ex.spawn(store(mem_push.run(ex), mem_push_rv));
+        ex.run();
+
+        std::printf("file: push %s, catch %s of %s\n", rv_name(file_push_rv),
+                    rv_name(file_catch_rv),
+                    std::string(file_catch.filename()).c_str());
+        std::printf("memory: push %s, catch %s of %s\n", rv_name(mem_push_rv),
+                    rv_name(mem_catch_rv),
+                    std::string(mem_catch.filename()).c_str());
+
+        if (file_push_rv || file_catch_rv || mem_push_rv || mem_catch_rv ||
+            file_catch.filename() != name || mem_catch.filename() != "mem")
+            return EXIT_FAILURE;
+        auto caught = mem_catch.data();
+        if (caught.size() != content.size() ||
+            std::memcmp(caught.data(), content.data(), content.size())) {
+            std::puts("Content caught in memory differs");
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception &e) {
+        std::printf("%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,458 @@
+/* TCP proxy impairing connections between push and catch as WAN links do,
+ * without root or netem: it delays data in either direction by latency
+ * with jitter, caps bandwidth, stalls all traffic periodically and resets
+ * connections after some bytes. Data keep their order.
+ *
+ * Connections to 127.0.0.1:PORT are forwarded to TARGET, push reaching
+ * catch through it with -p PORT. */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+
+#define CONN_MAX 32
+#define SEGMENT_SIZE 16384
+#define QUEUE_MAX (4 << 20) /* bytes held in either direction at most */
+
+/* Data read from one socket, to be written to the other one at time due. */
+struct segment {
+    struct segment *next;
+    double due;
+    size_t len;
+    size_t pos;            /* number of bytes already written */
+    unsigned char data[SEGMENT_SIZE];
+};
+
+/* One direction of a connection. */
+struct flow {
+    int from;
+    int to;
+    struct segment *head;
+    struct segment *tail;
+    size_t queued;         /* bytes held */
+    int eof;               /* read by from, to be passed on once sent */
+    int done;              /* write side of to has been shut down */
+    int blocked;           /* to cannot take more for now */
+    double last_due;
+    double next_write;     /* earliest time allowed by the bandwidth cap */
+    unsigned long long forwarded;
+};
+
+struct conn {
+    int used;
+    unsigned long id;
+    struct flow up;        /* from push to catch */
+    struct flow down;      /* from catch to push */
+};
+
+static double latency;       /* seconds added in either direction */
+static double jitter;        /* seconds added at most on top of latency */
+static double rate;          /* bytes per second of either direction or 0 */
+static double stall_len;     /* seconds of every stall_period of no traffic */
+static double stall_period;
+static unsigned long long reset_after; /* bytes sent up or 0 */
+static unsigned long resets = 1;       /* connections to reset */
+
+static struct sockaddr_in target;
+static struct conn conns[CONN_MAX];
+static double started;
+
+static void signal_handler(int signum)
+{
+    UNUSED(signum);
+    terminate = 1;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Time traffic is stalled until, or 0 if it flows at t. */
+static double stalled_until(double t)
+{
+    double phase;
+
+    if (stall_len <= 0)
+        return 0;
+    phase = t - started - (long)((t - started) / stall_period) * stall_period;
+    return (phase < stall_len) ? t - phase + stall_len : 0;
+}
+
+static void flow_init(struct flow *f, int from, int to)
+{
+    memset(f, '\0', sizeof *f);
+    f->from = from;
+    f->to = to;
+}
+
+static void flow_free(struct flow *f)
+{
+    while (f->head) {
+        struct segment *next = f->head->next;
+        free(f->head);
+        f->head = next;
+    }
+    f->tail = NULL;
+    f->queued = 0;
+}
+
+static void conn_close(struct conn *c, int reset)
+{
+    if (reset) {
+        struct linger lg = { 1, 0 };
+
+        /* Zero linger time makes close() send RST. */
+        setsockopt(c->up.from, SOL_SOCKET, SO_LINGER, &lg, sizeof lg);
+        setsockopt(c->up.to, SOL_SOCKET, SO_LINGER, &lg, sizeof lg);
+        info("Connection %lu reset after %llu bytes", c->id, c->up.forwarded);
+    } else {
+        info("Connection %lu closed after %llu bytes up, %llu down", c->id,
+             c->up.forwarded, c->down.forwarded);
+    }
+    close(c->up.from);
+    close(c->up.to);
+    flow_free(&c->up);
+    flow_free(&c->down);
+    c->used = 0;
+}
+
+/* Read what has come, return -1 on error. */
+static int flow_read(struct flow *f, double t)
+{
+    struct segment *s = malloc(sizeof *s);
+    ssize_t n;
+
+    if (!s)
+        die("Cannot allocate %lu bytes", (unsigned long)sizeof *s);
+
+    n = recv(f->from, s->data, sizeof s->data, 0);
+    if (n <= 0) {
+        free(s);
+        if (n == 0) {
+            f->eof = 1;
+            return 0;
+        }
+        return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    }
+
+    /* Jitter must not reorder data, so it only ever delays them more. */
+    s->next = NULL;
+    s->len = n;
+    s->pos = 0;
+    s->due = t + latency + jitter * rand() / RAND_MAX;
+    if (s->due < f->last_due)
+        s->due = f->last_due;
+    f->last_due = s->due;
+
+    if (f->tail)
+        f->tail->next = s;
+    else
+        f->head = s;
+    f->tail = s;
+    f->queued += n;
+    return 0;
+}
+
+/* Write what is due, return -1 on error. */
+static int flow_write(struct flow *f, double t)
+{
+    f->blocked = 0;
+    while (f->head && f->head->due <= t && f->next_write <= t) {
+        struct segment *s = f->head;
+        size_t len = s->len - s->pos;
+        ssize_t n;
+
+        /* Bursts are allowed for up to a millisecond of the rate. */
+        if (rate > 0 && len > rate / 1000 + 1)
+            len = rate / 1000 + 1;
+
+        n = send(f->to, s->data + s->pos, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EAGAIN) {
+            f->blocked = 1;
+            break;
+        } else if (n < 0) {
+            return (errno == EINTR) ? 0 : -1;
+        }
+
+        s->pos += n;
+        f->queued -= n;
+        f->forwarded += n;
+        if (rate > 0)
+            f->next_write = t + n / rate;
+        if (s->pos == s->len) {
+            f->head = s->next;
+            if (!f->head)
+                f->tail = NULL;
+            free(s);
+        }
+        if ((size_t)n < len)
+            break;
+    }
+
+    if (f->eof && !f->head && !f->done) {
+        shutdown(f->to, SHUT_WR);
+        f->done = 1;
+    }
+    return 0;
+}
+
+/* Time the flow has something to do at, or 0 if it waits for poll(). */
+static double flow_next(const struct flow *f)
+{
+    if (!f->head || f->blocked)
+        return 0;
+    return (f->head->due > f->next_write) ? f->head->due : f->next_write;
+}
+
+static void accept_conn(int listenfd)
+{
+    static unsigned long nconns;
+    int fd = accept(listenfd, NULL, NULL);
+    int peerfd, optval = 1;
+    int i;
+
+    if (fd < 0)
+        return;
+
+    for (i = 0; i < CONN_MAX && conns[i].used; i++)
+        ;
+    peerfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (i == CONN_MAX || peerfd < 0 ||
+        connect(peerfd, (struct sockaddr *)&target, sizeof target) != 0) {
+        err_errno("Cannot forward connection");
+        if (peerfd >= 0)
+            close(peerfd);
+        close(fd);
+        return;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof optval);
+    setsockopt(peerfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof optval);
+
+    conns[i].used = 1;
+    conns[i].id = ++nconns;
+    flow_init(&conns[i].up, fd, peerfd);
+    flow_init(&conns[i].down, peerfd, fd);
+    info("Connection %lu accepted", conns[i].id);
+}
+
+static void serve(int listenfd)
+{
+    while (!terminate) {
+        struct pollfd fds[1 + 2 * CONN_MAX];
+        struct conn *owners[1 + 2 * CONN_MAX];
+        struct flow *readers[1 + 2 * CONN_MAX];
+        double t = now(), next = 0, until = stalled_until(t);
+        int nfds = 1, timeout = -1;
+        int i;
+
+        fds[0].fd = listenfd;
+        fds[0].events = POLLIN;
+
+        for (i = 0; i < CONN_MAX; i++) {
+            struct conn *c = &conns[i];
+            struct flow *flows[2];
+            int j;
+
+            if (!c->used)
+                continue;
+
+            flows[0] = &c->up;
+            flows[1] = &c->down;
+            for (j = 0; j < 2; j++) {
+                struct flow *f = flows[j];
+                double fnext = flow_next(f);
+
+                /* The socket f reads from is the one the other flow writes
+                 * to, and it is ignored while neither has to wait for it. */
+                fds[nfds].events = 0;
+                if (!f->eof && f->queued < QUEUE_MAX)
+                    fds[nfds].events |= POLLIN;
+                if (flows[1 - j]->blocked)
+                    fds[nfds].events |= POLLOUT;
+                fds[nfds].fd = fds[nfds].events ? f->from : -1;
+                fds[nfds].revents = 0;
+                owners[nfds] = c;
+                readers[nfds++] = f;
+
+                if (until > 0 && fnext > 0 && fnext < until)
+                    fnext = until;
+                if (fnext > 0 && (next == 0 || fnext < next))
+                    next = fnext;
+            }
+        }
+
+        if (next > 0) {
+            timeout = (int)((next - t) * 1000 + 0.999);
+            if (timeout < 0)
+                timeout = 0;
+        }
+
+        if (poll(fds, nfds, timeout) < 0) {
+            if (errno != EINTR)
+                die_errno("poll()");
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+            accept_conn(listenfd);
+
+        /* Read what has come, then write what is due. */
+        t = now();
+        for (i = 1; i < nfds; i++) {
+            struct conn *c = owners[i];
+
+            if (c->used && (fds[i].events & POLLIN) &&
+                (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                flow_read(readers[i], t) != 0)
+                conn_close(c, 0);
+        }
+
+        for (i = 0; i < CONN_MAX; i++) {
+            struct conn *c = &conns[i];
+
+            if (!c->used)
+                continue;
+            if (!stalled_until(t) &&
+                (flow_write(&c->up, t) != 0 || flow_write(&c->down, t) != 0)) {
+                conn_close(c, 0);
+            } else if (reset_after && c->id <= resets &&
+                       c->up.forwarded >= reset_after) {
+                conn_close(c, 1);
+            } else if (c->up.done && c->down.done) {
+                conn_close(c, 0);
+            }
+        }
+    }
+}
+
+static double parse_ms(const char *str)
+{
+    char *end;
+    double ms = strtod(str, &end);
+
+    if (end == str || *end || ms < 0)
+        die("Invalid number of milliseconds %s", str);
+    return ms / 1000;
+}
+
+static void parse_target(const char *str)
+{
+    char host[256];
+    const char *colon = strrchr(str, ':');
+    struct hostent *hent;
+    char *end;
+    unsigned long port;
+
+    if (!colon || (size_t)(colon - str) >= sizeof host)
+        die("Invalid target %s, should be HOST:PORT", str);
+    memcpy(host, str, colon - str);
+    host[colon - str] = '\0';
+
+    port = strtoul(colon + 1, &end, 10);
+    hent = gethostbyname(host);
+    if (colon[1] == '\0' || *end || port > 65535 || !hent)
+        die("Invalid target %s, should be HOST:PORT", str);
+
+    target.sin_family = AF_INET;
+    target.sin_port = htons(port);
+    target.sin_addr = *(struct in_addr *)hent->h_addr;
+}
+
+static void usage(void)
+{
+    puts("usage: impair [-d ms] [-j ms] [-r mbits] [-s ms/ms]");
+    puts("              [-x bytes[/conns]] port host:port\n");
+    puts("Forward connections to 127.0.0.1:port to host:port, delaying");
+    puts("data in either direction by -d milliseconds plus up to -j");
+    puts("milliseconds of jitter, at -r Mbit/s at most. Option -s stalls");
+    puts("all traffic for the first milliseconds of every period of the");
+    puts("second ones, and -x resets connections once the given number of");
+    puts("bytes has been forwarded to host (just the first one unless the");
+    puts("number of connections to reset is given).");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, const char *argv[])
+{
+    struct sigaction sigact;
+    struct sockaddr_in sa;
+    int listenfd, optval = 1;
+    unsigned long port;
+    char *end;
+
+    for (;;) {
+        if (argc > 2 && !strcmp(argv[1], "-d")) {
+            latency = parse_ms(argv[2]);
+        } else if (argc > 2 && !strcmp(argv[1], "-j")) {
+            jitter = parse_ms(argv[2]);
+        } else if (argc > 2 && !strcmp(argv[1], "-r")) {
+            rate = strtod(argv[2], &end) * 1e6 / 8;
+            if (end == argv[2] || *end || rate <= 0)
+                die("Invalid rate %s", argv[2]);
+        } else if (argc > 2 && !strcmp(argv[1], "-s")) {
+            stall_len = strtod(argv[2], &end) / 1000;
+            if (*end != '/')
+                die("Invalid stall %s, should be ms/ms", argv[2]);
+            stall_period = parse_ms(end + 1);
+            if (stall_len <= 0 || stall_period <= stall_len)
+                die("Invalid stall %s, should be ms/ms", argv[2]);
+        } else if (argc > 2 && !strcmp(argv[1], "-x")) {
+            reset_after = strtoull(argv[2], &end, 10);
+            if (*end == '/')
+                resets = strtoul(end + 1, &end, 10);
+            if (*end || !reset_after)
+                die("Invalid reset %s", argv[2]);
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc != 3)
+        usage();
+
+    port = strtoul(argv[1], &end, 10);
+    if (*end || !port || port > 65535)
+        die("Invalid port %s", argv[1]);
+    parse_target(argv[2]);
+
+    memset(&sigact, '\0', sizeof sigact);
+    sigact.sa_handler = signal_handler;
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+
+    listenfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listenfd < 0)
+        die_errno("Cannot create TCP socket");
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
+
+    memset(&sa, '\0', sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listenfd, (struct sockaddr *)&sa, sizeof sa) != 0)
+        die_errno("Cannot bind to TCP port %lu", port);
+    if (listen(listenfd, CONN_MAX) != 0)
+        die_errno("Cannot listen to TCP socket");
+
+    started = now();
+    info("Forwarding port %lu to %s", port, argv[2]);
+    serve(listenfd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,354 @@
+/* Harness pushing files to catch over a transport in memory, with libpush
+ * and libcatch on threads of their own. The cost of the protocol and of
+ * hashing is measured without the network stack and file systems, whose
+ * noise would hide small regressions.
+ *
+ * For every set of COUNT files of SIZE bytes given as SIZExCOUNT, a line of
+ * tab-separated values is printed: wall time per file and per byte, CPU time
+ * of both sides and round trips per file, i.e. the number of times push has
+ * waited for a reply to what it has sent. The content caught is checked. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "libcatch.h"
+#include "libpush.h"
+
+#define PIPE_SIZE (256 * 1024) /* bytes in flight in either direction */
+#define CHUNK_SIZE 65536       /* content transferred at once */
+
+/* One direction of the transport. */
+struct pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned char buf[PIPE_SIZE];
+    size_t head;           /* position of the first byte in buf */
+    size_t len;            /* number of bytes in buf */
+    int closed;            /* by either end */
+};
+
+/* End of the transport, its priv. */
+struct end {
+    struct pipe *in;
+    struct pipe *out;
+    int sent;              /* something has been sent since last receive */
+    unsigned long turns;   /* receives after sends */
+};
+
+struct side {
+    pthread_t thread;
+    struct transport tr;
+    struct end end;
+    double cpu;            /* CPU time of the thread */
+    int rv;
+};
+
+static int calc_digest = 1;
+static off_t size;             /* of each file of the set */
+static unsigned long count;    /* of files of the set */
+static unsigned char *content; /* of each file */
+static struct sink sink;
+static unsigned char *chunkbuf; /* of catch */
+static unsigned long caught;   /* files */
+
+static volatile sig_atomic_t stop;
+
+static void pipe_init(struct pipe *p)
+{
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    p->head = p->len = 0;
+    p->closed = 0;
+}
+
+static void pipe_close(struct pipe *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->closed = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Either side going away closes both directions, so the other one does not
+ * wait for it forever. Data already sent can still be received. */
+static void end_close(struct end *end)
+{
+    pipe_close(end->in);
+    pipe_close(end->out);
+}
+
+static int mem_sendv(struct transport *tr, const struct tr_iovec *iov,
+                     int iovcnt, int more, size_t *nsent)
+{
+    struct end *end = tr->priv;
+    struct pipe *p = end->out;
+    int i;
+
+    UNUSED(more);
+    *nsent = 0;
+
+    pthread_mutex_lock(&p->lock);
+    while (p->len == PIPE_SIZE && !p->closed)
+        pthread_cond_wait(&p->cond, &p->lock);
+
+    for (i = 0; i < iovcnt && !p->closed; i++) {
+        const unsigned char *data = iov[i].base;
+        size_t left = iov[i].len;
+
+        while (left > 0 && p->len < PIPE_SIZE) {
+            size_t tail = (p->head + p->len) % PIPE_SIZE;
+            size_t n = (tail >= p->head) ? PIPE_SIZE - tail : p->head - tail;
+
+            if (n > left)
+                n = left;
+            memcpy(p->buf + tail, data, n);
+            p->len += n;
+            data += n;
+            left -= n;
+            *nsent += n;
+        }
+        if (left > 0)
+            break;
+    }
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    if (!*nsent)
+        return RV_CONNCLOSED;
+    end->sent = 1;
+    return 0;
+}
+
+static int mem_send(struct transport *tr, const void *buf, size_t len,
+                    size_t *nsent)
+{
+    struct tr_iovec iov;
+
+    iov.base = buf;
+    iov.len = len;
+    return mem_sendv(tr, &iov, 1, 0, nsent);
+}
+
+static int mem_recv(struct transport *tr, void *buf, size_t len,
+                    size_t *nreceived)
+{
+    struct end *end = tr->priv;
+    struct pipe *p = end->in;
+    unsigned char *data = buf;
+
+    *nreceived = 0;
+    if (end->sent) {
+        end->turns++;
+        end->sent = 0;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    while (p->len == 0 && !p->closed)
+        pthread_cond_wait(&p->cond, &p->lock);
+
+    while (len > 0 && p->len > 0) {
+        size_t n = PIPE_SIZE - p->head;
+
+        if (n > p->len)
+            n = p->len;
+        if (n > len)
+            n = len;
+        memcpy(data, p->buf + p->head, n);
+        p->head = (p->head + n) % PIPE_SIZE;
+        p->len -= n;
+        data += n;
+        len -= n;
+        *nreceived += n;
+    }
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    return *nreceived ? 0 : RV_CONNCLOSED;
+}
+
+static void mem_transport_init(struct side *side, struct pipe *in,
+                               struct pipe *out)
+{
+    struct transport *tr = &side->tr;
+
+    memset(tr, '\0', sizeof *tr);
+    tr->send = mem_send;
+    tr->recv = mem_recv;
+    tr->sendv = mem_sendv;
+    tr->fd_out = tr->fd_in = tr->fd_taken = -1;
+    tr->priv = &side->end;
+
+    memset(&side->end, '\0', sizeof side->end);
+    side->end.in = in;
+    side->end.out = out;
+}
+
+static void *push_thread(void *arg)
+{
+    struct side *side = arg;
+    struct push_context ctx;
+    struct source src;
+    char filename[24];
+    double wall, cpu;
+    unsigned long i;
+
+    get_clocks(&wall, &cpu);
+    for (i = 0; i < count && !side->rv; i++) {
+        mem_source_init(&src, content, size);
+        sprintf(filename, "f%06lu", i);
+
+        memset(&ctx, '\0', sizeof ctx);
+        ctx.filename = filename;
+        ctx.src = &src;
+        ctx.filelen = size;
+        ctx.tr = &side->tr;
+        ctx.chunksize = CHUNK_SIZE;
+        ctx.calc_digest = calc_digest;
+        ctx.terminate = &stop;
+        side->rv = libpush_push_file(&ctx);
+    }
+    get_clocks(&wall, &side->cpu);
+    side->cpu -= cpu;
+
+    /* Catch takes the end of the stream for the end of requests. */
+    end_close(&side->end);
+    return NULL;
+}
+
+static void *catch_thread(void *arg)
+{
+    struct side *side = arg;
+    struct catch_context ctx;
+    char filename[256];
+    double wall, cpu;
+
+    memset(&ctx, '\0', sizeof ctx);
+    ctx.filename = filename;
+    ctx.filenamesz = sizeof filename;
+    ctx.sink = &sink;
+    ctx.tr = &side->tr;
+    ctx.chunksize = CHUNK_SIZE;
+    ctx.chunkbuf = chunkbuf;
+    ctx.calc_digest = calc_digest;
+    ctx.terminate = &stop;
+
+    get_clocks(&wall, &cpu);
+    while ((side->rv = libcatch_handle_request(&ctx)) == 0)
+        caught++;
+    get_clocks(&wall, &side->cpu);
+    side->cpu -= cpu;
+
+    end_close(&side->end);
+    return NULL;
+}
+
+static off_t parse_size(const char *str, char **end)
+{
+    unsigned long long n = strtoull(str, end, 10);
+
+    switch (**end) {
+    case 'K':
+        n <<= 10;
+        break;
+    case 'M':
+        n <<= 20;
+        break;
+    case 'G':
+        n <<= 30;
+        break;
+    default:
+        return n;
+    }
+    (*end)++;
+    return n;
+}
+
+static void run_set(const char *set)
+{
+    struct pipe to_catch, to_push;
+    struct side push, catch;
+    double started, ended, cpu, secs;
+    char *end;
+    off_t i;
+
+    size = parse_size(set, &end);
+    if (end == set || *end != 'x')
+        die("Invalid set %s, should be SIZExCOUNT", set);
+    count = strtoul(end + 1, &end, 10);
+    if (*end != '\0' || (off_t)(size_t)size != size)
+        die("Invalid set %s, should be SIZExCOUNT", set);
+
+    content = malloc(size ? size : 1);
+    if (!content)
+        die("Cannot allocate %llu bytes", (unsigned long long)size);
+    for (i = 0; i < size; i++)
+        content[i] = (unsigned char)(i * 2654435761u >> 13);
+
+    pipe_init(&to_catch);
+    pipe_init(&to_push);
+    memset(&push, '\0', sizeof push);
+    memset(&catch, '\0', sizeof catch);
+    mem_transport_init(&push, &to_push, &to_catch);
+    mem_transport_init(&catch, &to_catch, &to_push);
+    caught = 0;
+
+    get_clocks(&started, &cpu);
+    if (pthread_create(&catch.thread, NULL, catch_thread, &catch) != 0 ||
+        pthread_create(&push.thread, NULL, push_thread, &push) != 0)
+        die("Cannot start threads");
+    pthread_join(push.thread, NULL);
+    pthread_join(catch.thread, NULL);
+    get_clocks(&ended, &cpu);
+
+    if (push.rv != 0)
+        die("Push of set %s failed: %s", set, rv_name(push.rv));
+    if (caught != count)
+        die("Catch of set %s failed: %s", set, rv_name(catch.rv));
+    if (count && (sink.len != size || memcmp(sink.data, content, size)))
+        die("Content of set %s caught differs", set);
+
+    secs = ended - started;
+    printf("%llu\t%lu\t%s\t%.6f\t%.3f\t", (unsigned long long)size, count,
+           calc_digest ? "on" : "off", secs, count ? secs * 1e6 / count : 0);
+    if (size && count)
+        printf("%.3f", secs * 1e9 / ((double)size * count));
+    else
+        printf("-");
+    printf("\t%.6f\t%.6f\t%.2f\n", push.cpu, catch.cpu,
+           count ? (double)push.end.turns / count : 0);
+
+    free(content);
+}
+
+int main(int argc, char *argv[])
+{
+    int i = 1;
+
+    if (argc > 1 && !strcmp(argv[1], "--no-digest")) {
+        calc_digest = 0;
+        i++;
+    }
+    if (i >= argc) {
+        puts("usage: memloop [--no-digest] SIZExCOUNT...\n");
+        puts("Push COUNT files of SIZE bytes (with optional suffix K, M");
+        puts("or G) for each set given over memory and measure it.");
+        exit(EXIT_FAILURE);
+    }
+
+    chunkbuf = malloc(CHUNK_SIZE);
+    if (!chunkbuf)
+        die("Cannot allocate %d bytes", CHUNK_SIZE);
+    mem_sink_init(&sink);
+
+    printf("size\tfiles\tdigest\tseconds\tus_per_file\tns_per_byte"
+           "\tpush_cpu_s\tcatch_cpu_s\tround_trips_per_file\n");
+    for (; i < argc; i++)
+        run_set(argv[i]);
+
+    mem_sink_free(&sink);
+    free(chunkbuf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,393 @@
+/* Harness pushing a file to a directory over a non-blocking socketpair with
+ * the incremental interfaces of libpush and libcatch, both driven by a single
+ * poll loop. Socket buffers are kept tiny and every transfer is cut short or
+ * refused at random, so sends end inside gathered segments, requests and
+ * replies arrive byte by byte and either side is often left waiting for
+ * the other.
+ *
+ * Files are caught with the file descriptor sink, or with the mapped one
+ * given -m. Given -l, they are caught into memory of at most MAXLEN bytes
+ * instead, and written out to DIR afterwards.
+ *
+ * With -w, push and catch run in processes of their own with the blocking
+ * wrappers instead, each delaying the other, and fail if the wrappers have
+ * spun rather than waited. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "fdio.h"
+#include "libcatch.h"
+#include "libpush.h"
+
+#define SOCK_BUFSIZE 4096  /* asked for, the kernel may round it up */
+#define CHUNK_SIZE 65536
+#define STALL_MS 5000      /* no progress for this long is a deadlock */
+#define WAIT_S 1           /* delay of the other side with -w */
+#define SPIN_CPU_S 0.2     /* most CPU time of waiting for WAIT_S */
+
+/* Transport passing on to another one at most a few bytes at once, with
+ * RV_WOULDBLOCK in between. Its priv. */
+struct trickle {
+    struct transport *inner;
+    unsigned long calls;
+};
+
+static const size_t trickle_sizes[] = { 1, 2, 5, 13, 100, 4096, 65536 };
+#define NSIZES (sizeof trickle_sizes / sizeof trickle_sizes[0])
+
+static volatile sig_atomic_t stop;
+static unsigned char *chunkbuf;
+static int mapped;             /* catch with the mapped sink */
+static off_t maxlen;           /* catch into memory of this many bytes */
+
+/* Return the most bytes the next call may transfer, or 0 to refuse it. */
+static size_t trickle_limit(struct transport *tr)
+{
+    struct trickle *t = tr->priv;
+    unsigned long n = t->calls++;
+
+    if (n % 2 == 0)
+        return 0;
+    return trickle_sizes[n / 2 % NSIZES];
+}
+
+static int trickle_sendv(struct transport *tr, const struct tr_iovec *iov,
+                         int iovcnt, int more, size_t *nsent)
+{
+    struct trickle *t = tr->priv;
+    struct tr_iovec cut[TR_IOVMAX];
+    size_t limit = trickle_limit(tr);
+    int i;
+
+    *nsent = 0;
+    if (!limit)
+        return RV_WOULDBLOCK;
+    for (i = 0; i < iovcnt && limit > 0; i++) {
+        cut[i] = iov[i];
+        if (cut[i].len > limit) {
+            cut[i].len = limit;
+            more = 1;
+        }
+        limit -= cut[i].len;
+    }
+    return t->inner->sendv(t->inner, cut, i, more || i < iovcnt, nsent);
+}
+
+static int trickle_send(struct transport *tr, const void *buf, size_t len,
+                        size_t *nsent)
+{
+    struct tr_iovec iov;
+
+    iov.base = buf;
+    iov.len = len;
+    return trickle_sendv(tr, &iov, 1, 0, nsent);
+}
+
+static int trickle_recv(struct transport *tr, void *buf, size_t len,
+                        size_t *nreceived)
+{
+    struct trickle *t = tr->priv;
+    size_t limit = trickle_limit(tr);
+
+    *nreceived = 0;
+    if (!limit)
+        return RV_WOULDBLOCK;
+    return t->inner->recv(t->inner, buf, len < limit ? len : limit,
+                          nreceived);
+}
+
+/* The trickle transport cannot wait, the poll loop does. */
+static void trickle_init(struct transport *tr, struct trickle *t,
+                         struct transport *inner)
+{
+    memset(tr, '\0', sizeof *tr);
+    tr->send = trickle_send;
+    tr->recv = trickle_recv;
+    tr->sendv = trickle_sendv;
+    tr->sk = inner->sk;
+    tr->fd_out = tr->fd_in = tr->fd_taken = -1;
+    tr->priv = t;
+
+    t->inner = inner;
+    t->calls = 0;
+}
+
+static void socketpair_nonblock(int sv[2])
+{
+    int size = SOCK_BUFSIZE;
+    int i;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+        die_errno("Cannot create socketpair");
+    for (i = 0; i < 2; i++) {
+        if (setsockopt(sv[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof size) ||
+            setsockopt(sv[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof size))
+            die_errno("Cannot set socket buffer size");
+        if (fcntl(sv[i], F_SETFL, fcntl(sv[i], F_GETFL) | O_NONBLOCK) != 0)
+            die_errno("Cannot make socket non-blocking");
+    }
+}
+
+static double cpu_seconds(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void push_init(struct push_context *ctx, struct source *src,
+                      const char *pathname, struct transport *tr)
+{
+    int fd = open(pathname, O_RDONLY);
+    off_t filelen;
+
+    if (fd < 0 || get_filelen(pathname, &filelen) != 0)
+        die_errno("Cannot open %s", pathname);
+    if (mmap_source_init(src, fd) != 0 && fd_source_init(src, fd) != 0)
+        die("Cannot read %s", pathname);
+
+    memset(ctx, '\0', sizeof *ctx);
+    ctx->filename = strrchr(pathname, '/') ? strrchr(pathname, '/') + 1
+                                           : pathname;
+    ctx->src = src;
+    ctx->filelen = filelen;
+    ctx->tr = tr;
+    ctx->calc_digest = 1;
+    ctx->terminate = &stop;
+}
+
+static void catch_init(struct catch_context *ctx, struct sink *sink,
+                       char *filename, size_t filenamesz, const char *dir,
+                       struct transport *tr)
+{
+    if (maxlen) {
+        mem_sink_init(sink);
+        sink->maxlen = maxlen;
+    } else {
+        int dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+
+        if (dirfd < 0)
+            die_errno("Cannot open %s", dir);
+        if (mapped)
+            mmap_sink_init(sink, dirfd);
+        else
+            fd_sink_init(sink, dirfd);
+    }
+
+    memset(ctx, '\0', sizeof *ctx);
+    ctx->filename = filename;
+    ctx->filenamesz = filenamesz;
+    ctx->sink = sink;
+    ctx->tr = tr;
+    ctx->chunksize = CHUNK_SIZE;
+    ctx->chunkbuf = chunkbuf;
+    ctx->calc_digest = 1;
+    ctx->terminate = &stop;
+}
+
+/* Write the file caught into memory to dir. */
+static void save_caught(const struct sink *sink, const char *dir,
+                        const char *filename)
+{
+    char pathname[4096];
+    FILE *fp;
+
+    snprintf(pathname, sizeof pathname, "%s/%s", dir, filename);
+    fp = fopen(pathname, "wb");
+    if (!fp || fwrite(sink->data, 1, sink->len, fp) != (size_t)sink->len ||
+        fclose(fp) != 0)
+        die_errno("Cannot write %s", pathname);
+}
+
+/* Push with sparse set and at offset fileoff in a single loop. */
+static int run_loop(const char *pathname, const char *dir, int sparse,
+                    off_t fileoff)
+{
+    struct transport push_sock, catch_sock, push_tr, catch_tr;
+    struct trickle push_t, catch_t;
+    struct push_context push;
+    struct catch_context catch;
+    struct source src;
+    struct sink sink;
+    char filename[256];
+    unsigned long push_waits = 0, catch_waits = 0, requests = 1;
+    int push_status, catch_status;
+    int sv[2];
+
+    socketpair_nonblock(sv);
+    sock_transport_init(&push_sock, sv[0]);
+    sock_transport_init(&catch_sock, sv[1]);
+    trickle_init(&push_tr, &push_t, &push_sock);
+    trickle_init(&catch_tr, &catch_t, &catch_sock);
+
+    push_init(&push, &src, pathname, &push_tr);
+    push.sparse = sparse;
+    push.fileoff = fileoff;
+    catch_init(&catch, &sink, filename, sizeof filename, dir, &catch_tr);
+
+    libpush_begin(&push);
+    libcatch_begin(&catch);
+    push_status = libpush_continue(&push);
+    catch_status = libcatch_continue(&catch);
+
+    while (push_status != PUSH_DONE || catch_status != CATCH_DONE) {
+        struct pollfd pfd[2];
+        int n;
+
+        pfd[0].fd = push_status != PUSH_DONE ? sv[0] : -1;
+        pfd[0].events = push_status == PUSH_WANT_WRITE ? POLLOUT : POLLIN;
+        pfd[1].fd = catch_status != CATCH_DONE ? sv[1] : -1;
+        pfd[1].events = catch_status == CATCH_WANT_WRITE ? POLLOUT : POLLIN;
+
+        n = poll(pfd, 2, STALL_MS);
+        if (n < 0 && errno != EINTR)
+            die_errno("Cannot poll");
+        if (n == 0)
+            die("Push (%d) and catch (%d) wait for each other",
+                push_status, catch_status);
+
+        if (n > 0 && pfd[0].revents) {
+            push_status = libpush_continue(&push);
+            push_waits++;
+        }
+        if (n > 0 && pfd[1].revents) {
+            catch_status = libcatch_continue(&catch);
+            catch_waits++;
+            /* The push offered at a wrong offset tries again. */
+            if (catch_status == CATCH_DONE && catch.rv == RV_OFFSET) {
+                libcatch_begin(&catch);
+                catch_status = libcatch_continue(&catch);
+                requests++;
+            }
+        }
+    }
+
+    printf("push %s after %lu waits, catch %s after %lu waits, %lu requests\n",
+           rv_name(push.rv), push_waits, rv_name(catch.rv), catch_waits,
+           requests);
+    if (maxlen) {
+        if (!catch.rv)
+            save_caught(&sink, dir, filename);
+        mem_sink_free(&sink);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    return push.rv == 0 && catch.rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void delay_push(const struct catch_context *ctx, int stage)
+{
+    UNUSED(ctx);
+    if (stage == CATCH_NEXT_FILE)
+        sleep(WAIT_S);
+}
+
+/* Push with the blocking wrappers of both libraries, catch in a child. */
+static int run_wrappers(const char *pathname, const char *dir)
+{
+    struct transport tr;
+    int sv[2];
+    pid_t pid;
+    int status, rv;
+    double cpu;
+
+    socketpair_nonblock(sv);
+    pid = fork();
+    if (pid < 0)
+        die_errno("Cannot fork");
+
+    if (pid == 0) {
+        struct catch_context ctx;
+        struct sink sink;
+        char filename[256];
+
+        close(sv[0]);
+        sock_transport_init(&tr, sv[1]);
+        catch_init(&ctx, &sink, filename, sizeof filename, dir, &tr);
+        /* The request is a second late, and so is the reply. */
+        ctx.on_stage_change = delay_push;
+        rv = libcatch_handle_request(&ctx);
+        cpu = cpu_seconds();
+        printf("catch %s in %.3f s of CPU\n", rv_name(rv), cpu);
+        exit(rv == 0 && cpu < SPIN_CPU_S ? EXIT_SUCCESS : EXIT_FAILURE);
+    } else {
+        struct push_context ctx;
+        struct source src;
+
+        close(sv[1]);
+        sleep(WAIT_S);
+        sock_transport_init(&tr, sv[0]);
+        push_init(&ctx, &src, pathname, &tr);
+        cpu = cpu_seconds();
+        rv = libpush_push_file(&ctx);
+        cpu = cpu_seconds() - cpu;
+        printf("push %s in %.3f s of CPU\n", rv_name(rv), cpu);
+        close(sv[0]);
+
+        if (waitpid(pid, &status, 0) != pid)
+            die_errno("Cannot wait for catch");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        return rv == 0 && cpu < SPIN_CPU_S ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int sparse = 0, wrappers = 0;
+    off_t fileoff = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:mso:w")) != -1) {
+        switch (opt) {
+        case 'l':
+            maxlen = strtoll(optarg, NULL, 10);
+            break;
+        case 'm':
+            mapped = 1;
+            break;
+        case 's':
+            sparse = 1;
+            break;
+        case 'o':
+            fileoff = strtoll(optarg, NULL, 10);
+            break;
+        case 'w':
+            wrappers = 1;
+            break;
+        default:
+            argc = 0;
+        }
+    }
+    if (argc - optind != 2) {
+        puts("usage: nbloop [-m | -l MAXLEN] [-s] [-o OFFSET] [-w] "
+             "FILE DIR\n");
+        puts("Push FILE to directory DIR over a non-blocking socketpair,");
+        puts("sparse with -s and resuming at OFFSET with -o. With -w, use");
+        puts("the blocking wrappers and check that they wait. Catch with");
+        puts("the mapped sink with -m, or into memory of at most MAXLEN");
+        puts("bytes with -l.");
+        exit(EXIT_FAILURE);
+    }
+
+    chunkbuf = malloc(CHUNK_SIZE);
+    if (!chunkbuf)
+        die("Cannot allocate %d bytes", CHUNK_SIZE);
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    if (wrappers)
+        return run_wrappers(argv[optind], argv[optind + 1]);
+    return run_loop(argv[optind], argv[optind + 1], sparse, fileoff);
+}
@@ -0,0 +1,78 @@
+#include "common.h"
+#include "transport.h"
+
+static int sock_send(struct transport *tr, const void *buf, size_t len,
+                     size_t *nsent)
+{
+    return send_some(tr->sk, buf, len, nsent);
+}
+
+static int sock_sendv(struct transport *tr, const struct tr_iovec *iov,
+                      int iovcnt, int more, size_t *nsent)
+{
+    return send_somev(tr->sk, iov, iovcnt, more, nsent);
+}
+
+static int sock_recv(struct transport *tr, void *buf, size_t len,
+                     size_t *nreceived)
+{
+    return recv_some(tr->sk, buf, len, nreceived);
+}
+
+static int sock_wait(struct transport *tr, int writing)
+{
+    return wait_ready(tr->sk, writing);
+}
+
+void sock_transport_init(struct transport *tr, Sock sk)
+{
+    tr->send = sock_send;
+    tr->recv = sock_recv;
+    tr->sendv = sock_sendv;
+    tr->pass_fd = NULL;
+    tr->passed_fd = NULL;
+    tr->wait = sock_wait;
+    tr->sk = sk;
+    tr->fd_out = -1;
+    tr->fd_in = -1;
+    tr->fd_taken = -1;
+    tr->priv = NULL;
+}
+
+int transport_send_entire(struct transport *tr, const void *buf, size_t len,
+                          volatile sig_atomic_t *terminate)
+{
+    size_t nleft = len;
+    const char *ptr = buf;
+
+    while (!*terminate && nleft > 0) {
+        size_t nsent = 0;
+        int rv = tr->send(tr, ptr, nleft, &nsent);
+        if (rv == RV_WOULDBLOCK && tr->wait)
+            rv = tr->wait(tr, 1);
+        if (rv && rv != RV_WOULDBLOCK)
+            return rv;
+        nleft -= nsent;
+        ptr += nsent;
+    }
+    return nleft ? RV_TERMINATED : 0;
+}
+
+int transport_recv_entire(struct transport *tr, void *buf, size_t len,
+                          volatile sig_atomic_t *terminate)
+{
+    size_t nleft = len;
+    char *ptr = buf;
+
+    while (!*terminate && nleft > 0) {
+        size_t nreceived = 0;
+        int rv = tr->recv(tr, ptr, nleft, &nreceived);
+        if (rv == RV_WOULDBLOCK && tr->wait)
+            rv = tr->wait(tr, 0);
+        if (rv && rv != RV_WOULDBLOCK)
+            return rv;
+        nleft -= nreceived;
+        ptr += nreceived;
+    }
+    return nleft ? RV_TERMINATED : 0;
+}
@@ -0,0 +1,82 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "platform.h"
+#include "retval.h"
+#include <signal.h>
+#include <stddef.h>
+
+#define TR_IOVMAX 4 /* most segments of a gathered send */
+
+/* Segment of a gathered send. */
+struct tr_iovec {
+    const void *base;
+    size_t len;
+};
+
+/* Byte stream the peers talk FPP over.
+ *
+ * Both functions transfer up to len bytes and return 0 along with the number
+ * of bytes actually transferred (which may be 0 if interrupted), RV_WOULDBLOCK
+ * if the transport is not ready, or an error number otherwise. sendv() sends
+ * up to iovcnt (at most TR_IOVMAX) segments at once, so a message assembled
+ * of several buffers can go out in a single segment. Unless more is zero,
+ * it may hold the data back until more is sent.
+ *
+ * Transports between processes on the same host may also pass descriptors
+ * of open files, so the content need not go through the transport. Then
+ * pass_fd() attaches descriptor fd to the next byte sent and returns 0 or
+ * an error number, and passed_fd() returns the descriptor received since
+ * its previous call or -1. The transport closes received descriptors
+ * on the next call of passed_fd(). Both are NULL for other transports.
+ *
+ * wait() waits until the transport is ready to send if writing is set, or
+ * to receive otherwise, and returns 0 (also if interrupted) or an error
+ * number. Transports that cannot wait have it NULL and are retried at once
+ * after RV_WOULDBLOCK. */
+struct transport {
+    int (*send)(struct transport *tr, const void *buf, size_t len,
+                size_t *nsent);
+    int (*recv)(struct transport *tr, void *buf, size_t len,
+                size_t *nreceived);
+    int (*sendv)(struct transport *tr, const struct tr_iovec *iov,
+                 int iovcnt, int more, size_t *nsent);
+    int (*pass_fd)(struct transport *tr, int fd);
+    int (*passed_fd)(struct transport *tr);
+    int (*wait)(struct transport *tr, int writing);
+    Sock sk;      /* connected socket of the socket transport */
+    int fd_out;   /* descriptor to be passed with the next byte sent */
+    int fd_in;    /* descriptor received, not returned by passed_fd() yet */
+    int fd_taken; /* descriptor returned by passed_fd() last time */
+    void *priv;   /* private data of other transports */
+};
+
+/* Initialize transport over a connected socket. */
+void sock_transport_init(struct transport *tr, Sock sk);
+
+/* Return 0 if entire buffer was transferred, RV_TERMINATED if *terminate
+ * got set before that, or error number otherwise. Non-blocking transports
+ * are waited for with wait(). */
+int transport_send_entire(struct transport *tr, const void *buf, size_t len,
+                          volatile sig_atomic_t *terminate);
+int transport_recv_entire(struct transport *tr, void *buf, size_t len,
+                          volatile sig_atomic_t *terminate);
+
+/* The application must provide the following as functions or macros. */
+
+/* Send or receive up to len bytes over the socket, never blocking on
+ * a non-blocking one. The return values are the same as of transport
+ * functions. */
+/* int send_some(Sock sk, const void *buf, size_t len, size_t *nsent); */
+/* int recv_some(Sock sk, void *buf, size_t len, size_t *nreceived); */
+
+/* Send up to iovcnt segments as sendv() of transports does. Platforms unable
+ * to gather may send just a part of the first segment. */
+/* int send_somev(Sock sk, const struct tr_iovec *iov, int iovcnt, int more,
+                  size_t *nsent); */
+
+/* Wait until the socket is ready to send if writing is set, or to receive
+ * otherwise, as wait() of transports does. */
+/* int wait_ready(Sock sk, int writing); */
+
+#endif
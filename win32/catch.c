@@ -54,12 +54,18 @@ static int handle_connection(int sockfd)
     int rv = 0;
     int close_connection = 0;
     char filename[4096];
+    struct transport tr;
+    struct sink sink;
     struct catch_context ctx;
 
+    sock_transport_init(&tr, sockfd);
+    stdio_sink_init(&sink);
+
     memset(&ctx, '\0', sizeof ctx);
     ctx.terminate = &terminate;
     ctx.on_stage_change = on_stage_change;
-    ctx.sk = sockfd;
+    ctx.tr = &tr;
+    ctx.sink = &sink;
     ctx.filename = filename;
     ctx.filenamesz = sizeof filename;
     ctx.calc_digest = 1;
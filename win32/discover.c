@@ -6,7 +6,7 @@
 
 void handle_discovery(int fd, const char *myname)
 {
-    uint8_t req;
+    uint8_t req[2];
     struct sockaddr_storage ss;
     int ss_len = sizeof ss;
     size_t namelen = strlen(myname);
@@ -15,8 +15,11 @@ void handle_discovery(int fd, const char *myname)
         namelen = PEERNAME_MAX;
     buf[0] = namelen;
     memcpy(&buf[1], myname, namelen);
-    if (recvfrom(fd, (char *)&req, 1, 0, (struct sockaddr *)&ss, &ss_len) == 1) {
-        if (req == DISCOVERY_VER)
+    /* Requests of version 2 have two bytes, and Winsock fails with
+     * WSAEMSGSIZE rather than truncating a datagram too long. */
+    if (recvfrom(fd, (char *)req, sizeof req, 0, (struct sockaddr *)&ss,
+                 &ss_len) >= 1) {
+        if (req[0] == DISCOVERY_VER_MIN)
             sendto(fd, buf, namelen + 1, 0, (struct sockaddr *)&ss, ss_len);
     }
 }
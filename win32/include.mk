@@ -16,7 +16,11 @@ wincatch-objs += libcatch.o
 wincatch-objs += common.o
 wincatch-objs += discover.o
 wincatch-objs += platform.o
+wincatch-objs += progress.o
 wincatch-objs += sha1.o
+wincatch-objs += sink.o
+wincatch-objs += stats.o
+wincatch-objs += transport.o
 wincatch-objs += wincatch.res
 wincatch-libs += -lws2_32
 objs += $(wincatch-objs)
@@ -1,5 +1,6 @@
 #include "common.h"
 #include "platform.h"
+#include "transport.h"
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -43,49 +44,93 @@ int get_filelen(const char *filename, off_t *filelen)
     return rv;
 }
 
-/* Returns 0 if entire buffer was sent, or error number otherwise. */
-int send_entire(Sock sk, const void *buf, size_t len)
+static int send_error(void)
 {
-    size_t nleft = len;
-    const char *ptr = buf;
-
-    while (!terminate && nleft > 0) {
-        ssize_t nsent = send(sk, ptr, nleft, 0);
-        if (nsent >= 0) {
-            nleft -= nsent;
-            ptr += nsent;
-        } else {
-            int err = WSAGetLastError();
-            if (err == WSAECONNRESET) {
-                /* Peer closed the connection. */
-                return RV_CONNCLOSED;
-            } else {
-                return RV_NETIOERROR;
-            }
-        }
+    int err = WSAGetLastError();
+    if (err == WSAEWOULDBLOCK) {
+        return RV_WOULDBLOCK;
+    } else if (err == WSAECONNRESET) {
+        /* Peer closed the connection. */
+        return RV_CONNCLOSED;
+    } else if (err != WSAEINTR) {
+        return RV_NETIOERROR;
     }
-    return nleft ? RV_TERMINATED : 0;
+    return 0;
 }
 
-/* Returns 0 if entire buffer was received, or error number otherwise. */
-int recv_entire(Sock sk, void *buf, size_t len)
+/* Returns 0 and number of bytes sent, RV_WOULDBLOCK if non-blocking socket
+ * is not ready, or error number. */
+int send_some(Sock sk, const void *buf, size_t len, size_t *nsent)
 {
-    size_t nleft = len;
-    char *ptr = buf;
-
-    while (!terminate && nleft > 0) {
-        ssize_t nreceived = recv(sk, ptr, nleft, 0);
-        if (nreceived > 0) {
-            nleft -= nreceived;
-            ptr += nreceived;
-        } else if (nreceived == 0) {
-            /* Peer closed the connection. */
-            return RV_CONNCLOSED;
-        } else {
+    int n = send(sk, buf, len, 0);
+
+    *nsent = 0;
+    if (n < 0)
+        return send_error();
+
+    *nsent = n;
+    return 0;
+}
+
+/* Same as send_some(), but the segments go out at once. Winsock has no
+ * means to hold data back, so more is ignored. */
+int send_somev(Sock sk, const struct tr_iovec *iov, int iovcnt, int more,
+               size_t *nsent)
+{
+    WSABUF bufs[TR_IOVMAX];
+    DWORD n = 0;
+    int i;
+    UNUSED(more);
+
+    for (i = 0; i < iovcnt && i < TR_IOVMAX; i++) {
+        bufs[i].buf = (char *)iov[i].base;
+        bufs[i].len = iov[i].len;
+    }
+
+    *nsent = 0;
+    if (WSASend(sk, bufs, i, &n, 0, NULL, NULL) != 0)
+        return send_error();
+
+    *nsent = n;
+    return 0;
+}
+
+/* Returns 0 and number of bytes received, RV_WOULDBLOCK if non-blocking
+ * socket is not ready, or error number. */
+int recv_some(Sock sk, void *buf, size_t len, size_t *nreceived)
+{
+    int n = recv(sk, buf, len, 0);
+
+    *nreceived = 0;
+    if (n > 0) {
+        *nreceived = n;
+    } else if (n == 0) {
+        /* Peer closed the connection. */
+        return RV_CONNCLOSED;
+    } else {
+        int err = WSAGetLastError();
+        if (err == WSAEWOULDBLOCK)
+            return RV_WOULDBLOCK;
+        else if (err != WSAEINTR)
             return RV_NETIOERROR;
-        }
     }
-    return nleft ? RV_TERMINATED : 0;
+    return 0;
+}
+
+/* Returns 0 once the socket is ready (or has failed, which the next
+ * transfer tells), or if interrupted, or error number. */
+int wait_ready(Sock sk, int writing)
+{
+    fd_set fds, efds;
+
+    FD_ZERO(&fds);
+    FD_ZERO(&efds);
+    FD_SET(sk, &fds);
+    FD_SET(sk, &efds);
+    if (select(0, writing ? NULL : &fds, writing ? &fds : NULL, &efds,
+               NULL) == SOCKET_ERROR && WSAGetLastError() != WSAEINTR)
+        return RV_NETIOERROR;
+    return 0;
 }
 
 void err_net(const char *fmt, ...)
@@ -106,3 +151,23 @@ void die_net(const char *fmt, ...)
     fprintf(stderr, ": %d\n", wsa_last_error);
     exit(EXIT_FAILURE);
 }
+
+void get_clocks(double *wall, double *cpu)
+{
+    LARGE_INTEGER count, freq;
+    FILETIME creation, exit, kernel, user;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    *wall = (double)count.QuadPart / freq.QuadPart;
+
+    if (!cpu)
+        return;
+
+    /* Thread times are in units of 100 ns. */
+    *cpu = 0;
+    if (GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        *cpu = ((double)kernel.dwHighDateTime + user.dwHighDateTime) *
+               429.4967296 +
+               ((double)kernel.dwLowDateTime + user.dwLowDateTime) / 1e7;
+}
@@ -25,19 +25,26 @@ static uint32_t clock_get_monotonic(void)
     return GetTickCount();
 }
 
-static struct in_addr *iterate_broadcast_addresses(struct in_addr *prev)
+struct broadcast_iterator {
+    MIB_IPADDRTABLE *ipTable;
+    DWORD pos;
+    struct in_addr last;
+};
+
+/* Start iterating with prev set to NULL, continue with the previously
+ * returned address until NULL is returned. The iterator must be zeroed
+ * before the first use. */
+static struct in_addr *iterate_broadcast_addresses(
+        struct broadcast_iterator *it, struct in_addr *prev)
 {
-    static MIB_IPADDRTABLE *ipTable = NULL;
-    static DWORD pos;
-    static struct in_addr last;
     struct in_addr *next = NULL;
 
     if (!prev) {
         /* New round of iterations invalidates ongoing */
-        if (ipTable) {
-            free(ipTable);
-            ipTable = NULL;
-            pos = 0;
+        if (it->ipTable) {
+            free(it->ipTable);
+            it->ipTable = NULL;
+            it->pos = 0;
         }
 
         // Adapted from example code at http://msdn2.microsoft.com/en-us/library/aa365917.aspx
@@ -45,35 +52,35 @@ static struct in_addr *iterate_broadcast_addresses(struct in_addr *prev)
         // multiple times in order to deal with potential race conditions properly.
         ULONG bufLen = 0;
         for (int i = 0; i < 5; i++) {
-            DWORD ipRet = GetIpAddrTable(ipTable, &bufLen, 0);
+            DWORD ipRet = GetIpAddrTable(it->ipTable, &bufLen, 0);
             if (ipRet == ERROR_INSUFFICIENT_BUFFER) {
-                free(ipTable);  // in case we had previously allocated it
-                ipTable = malloc(bufLen);
+                free(it->ipTable);  // in case we had previously allocated it
+                it->ipTable = malloc(bufLen);
             } else if (ipRet == NO_ERROR) {
                 break;
             } else {
-                free(ipTable);
-                ipTable = NULL;
+                free(it->ipTable);
+                it->ipTable = NULL;
                 break;
             }
         }
-    } else if (prev != &last) {
+    } else if (prev != &it->last) {
         return NULL;
     }
 
-    if (ipTable) {
-        if (pos < ipTable->dwNumEntries) {
-            const MIB_IPADDRROW *row = &(ipTable->table[pos]);
+    if (it->ipTable) {
+        if (it->pos < it->ipTable->dwNumEntries) {
+            const MIB_IPADDRROW *row = &(it->ipTable->table[it->pos]);
             DWORD addr      = ntohl(row->dwAddr);
             DWORD netmask   = ntohl(row->dwMask);
             DWORD bcastaddr = addr | ~netmask;
-            last.s_addr = htonl(bcastaddr);
-            next = &last;
-            pos++;
+            it->last.s_addr = htonl(bcastaddr);
+            next = &it->last;
+            it->pos++;
         } else {
-            free(ipTable);
-            ipTable = NULL;
-            pos = 0;
+            free(it->ipTable);
+            it->ipTable = NULL;
+            it->pos = 0;
         }
     }
 
@@ -82,14 +89,16 @@ static struct in_addr *iterate_broadcast_addresses(struct in_addr *prev)
 
 static int discover_peer(int sockfd, const char *peername, struct in_addr *inp)
 {
-    uint8_t req = DISCOVERY_VER;
+    uint8_t req = DISCOVERY_VER_MIN;
     uint32_t start_ms = clock_get_monotonic();
+    struct broadcast_iterator it;
     struct in_addr *bcast_addr = NULL;
     struct sockaddr_in sa;
     sa.sin_family = AF_INET;
     sa.sin_port = htons(CATCH_PORT);
+    memset(&it, '\0', sizeof it);
 
-    while ((bcast_addr = iterate_broadcast_addresses(bcast_addr))) {
+    while ((bcast_addr = iterate_broadcast_addresses(&it, bcast_addr))) {
         sa.sin_addr = *bcast_addr;
         info("Send discovery to %s", inet_ntoa(sa.sin_addr));
         if (sendto(sockfd, (char *)&req, sizeof req, 0,
@@ -234,27 +243,33 @@ static void die_push(const struct push_context *ctx, const char *msg)
     exit(EXIT_FAILURE);
 }
 
-static int push_file(int sockfd, const char *pathname)
+static int push_file(struct transport *tr, const char *pathname)
 {
     struct push_context ctx;
+    struct source src;
+    FILE *fp;
+
+    memset(&ctx, '\0', sizeof ctx);
     ctx.terminate = &terminate;
-    ctx.sk = sockfd;
+    ctx.tr = tr;
     ctx.filename = basename(pathname);
     ctx.filelen = get_filelen_or_die(pathname);
     ctx.fileoff = 0;
     ctx.calc_digest = 1;
     ctx.forced = forced;
     ctx.on_stage_change = on_stage_change;
-    ctx.fp = fopen(pathname, "rb"); /* b in mode is important for Windows */
-    if (!ctx.fp)
+    fp = fopen(pathname, "rb"); /* b in mode is important for Windows */
+    if (!fp)
         die_errno("Cannot open file %s", pathname);
+    stdio_source_init(&src, fp, ctx.filelen);
+    ctx.src = &src;
 
     info("Sending file %s (%llu bytes)", pathname,
          (unsigned long long)ctx.filelen);
 
     int rv = libpush_push_file(&ctx);
 
-    fclose(ctx.fp);
+    fclose(fp);
 
     switch (rv) {
     case 0:
@@ -296,6 +311,7 @@ int main(int argc, const char *argv[])
     int i;
     int sockfd;
     struct sockaddr_in sa;
+    struct transport tr;
 
     if (argc > 1 && !strcmp(argv[1], "-f")) {
         forced = 1;
@@ -333,8 +349,10 @@ int main(int argc, const char *argv[])
     if (connect(sockfd, (struct sockaddr *)&sa, sizeof sa) != 0)
         die_net("Cannot connect to remote host");
 
+    sock_transport_init(&tr, sockfd);
+
     for (i = 2; i < argc && !terminate; i++)
-        if (push_file(sockfd, argv[i]) != 0)
+        if (push_file(&tr, argv[i]) != 0)
             ret = EXIT_FAILURE;
 
     closesocket(sockfd);
@@ -2,6 +2,7 @@
 #include <windows.h>
 #include <shellapi.h>
 #include <stdio.h>
+#include <string.h>
 #include "common.h"
 #include "libcatch.h"
 #include "resource.h"
@@ -361,10 +362,15 @@ DWORD WINAPI NetThreadProc(LPVOID lpParameter)
 {
     struct sockaddr_in sa;
     struct catch_context ctx;
+    struct transport tr;
+    struct sink sink;
     SOCKET tcpfd, udpfd;
     UNUSED(lpParameter);
 
-    ctx.terminate = 0;
+    memset(&ctx, '\0', sizeof ctx);
+    stdio_sink_init(&sink);
+    ctx.sink = &sink;
+    ctx.terminate = &terminate;
     ctx.on_progress = &ReportProgress;
     ctx.confirm_file = &ConfirmIncomingFile;
 //    ctx.is_termination_requested = &IsTerminationRequested;
@@ -412,7 +418,8 @@ DWORD WINAPI NetThreadProc(LPVOID lpParameter)
                 int sa_len = sizeof sa;
                 int connfd = accept(tcpfd, (struct sockaddr *)&sa, &sa_len);
                 if (connfd >= 0) {
-                    ctx.sk = connfd;
+                    sock_transport_init(&tr, connfd);
+                    ctx.tr = &tr;
                     while (libcatch_handle_request(&ctx) == 0)
                         ;
                     closesocket(connfd);